@@ -0,0 +1,26 @@
+#ifndef BankIo_h
+#define BankIo_h
+
+#include <cstdint>
+
+#define MAX_BANK_CHANNELS 8
+
+// Lines and clock for a ValveBank. Every call covers all channels at once:
+// bit n of a mask belongs to channel n. Only the bank's timing thread
+// calls into it.
+class BankIo {
+public:
+    virtual ~BankIo() {}
+
+    virtual int channelCount() const = 0; // Number of valves on the bank
+    virtual bool isOpen() const = 0; // Check if the lines were acquired
+    virtual void writeSteps(uint32_t mask) = 0; // Drive every step line
+    virtual void writeDirections(uint32_t mask) = 0; // Drive every direction line (1 opens the valve)
+    virtual void writeEnables(uint32_t mask) = 0; // Drive every driver enable line
+    virtual void readLimits(uint32_t &top, uint32_t &bottom) = 0; // Bits set for triggered switches
+
+    virtual uint64_t now() = 0; // Monotonic time in nanoseconds
+    virtual void sleepUntil(uint64_t deadline) = 0; // Sleep until the given now() time
+};
+
+#endif // BankIo_h
@@ -0,0 +1,329 @@
+#include "CommandServer.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+CommandServer::CommandServer(PiStepper &stepper) :
+    _stepper(stepper),
+    _listenFd(-1),
+    _wakeFd(-1),
+    _listenerId(0),
+    _stopping(false)
+{
+}
+
+CommandServer::~CommandServer() {
+    stop();
+}
+
+bool CommandServer::start(const char *path) {
+    stop();
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof(address.sun_path)) {
+        std::cerr << "Command socket path is too long: " << path << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, path);
+
+    _listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_listenFd < 0) {
+        std::cerr << "Failed to create command socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // A socket left by a server that exited refuses connections and is
+    // replaced; one that still answers belongs to a running driver
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe >= 0) {
+        int result = connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+        int error = errno;
+        close(probe);
+        if (result == 0 || error == EAGAIN) {
+            std::cerr << "Command socket " << path << " is in use by another server" << std::endl;
+            close(_listenFd);
+            _listenFd = -1;
+            return false;
+        }
+        if (error == ECONNREFUSED) {
+            unlink(path);
+        }
+    }
+    if (bind(_listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(_listenFd, COMMAND_MAX_CLIENTS) != 0) {
+        std::cerr << "Failed to listen on " << path << ": " << std::strerror(errno) << std::endl;
+        close(_listenFd);
+        _listenFd = -1;
+        return false;
+    }
+    _path = path;
+
+    _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_wakeFd < 0) {
+        std::cerr << "Failed to create command server wake-up: " << std::strerror(errno) << std::endl;
+        stop();
+        return false;
+    }
+
+    _latest.store(_stepper.getMotionState());
+    _listenerId = _stepper.addMotionListener([this](const MotionState &state) {
+        _latest.store(state);
+        uint64_t one = 1;
+        ssize_t ignored = write(_wakeFd, &one, sizeof(one));
+        (void)ignored;
+    });
+
+    _stopping = false;
+    _thread = std::thread(&CommandServer::run, this);
+    return true;
+}
+
+void CommandServer::stop() {
+    if (_thread.joinable()) {
+        _stepper.removeMotionListener(_listenerId);
+        _listenerId = 0;
+        _stopping = true;
+        uint64_t one = 1;
+        ssize_t ignored = write(_wakeFd, &one, sizeof(one));
+        (void)ignored;
+        _thread.join();
+    }
+    for (Client &client : _clients) {
+        close(client.fd);
+    }
+    _clients.clear();
+    if (_wakeFd >= 0) {
+        close(_wakeFd);
+        _wakeFd = -1;
+    }
+    if (_listenFd >= 0) {
+        close(_listenFd);
+        _listenFd = -1;
+        unlink(_path.c_str());
+    }
+}
+
+void CommandServer::run() {
+    std::vector<pollfd> fds;
+    while (true) {
+        fds.clear();
+        fds.push_back({_wakeFd, POLLIN, 0});
+        fds.push_back({_listenFd, POLLIN, 0});
+        for (const Client &client : _clients) {
+            // A client that leaves its responses unread is not read either until it catches up
+            short events = client.output.size() < COMMAND_OUTPUT_LIMIT ? POLLIN : 0;
+            fds.push_back({client.fd, static_cast<short>(events | (client.output.empty() ? 0 : POLLOUT)), 0});
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Command server poll failed: " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            ssize_t ignored = read(_wakeFd, &count, sizeof(count));
+            (void)ignored;
+            if (_stopping) {
+                return;
+            }
+            publishPosition();
+        }
+
+        // Clients are only removed here, so fds[i + 2] still matches _clients[i]
+        size_t clientCount = _clients.size();
+        std::vector<bool> drop(clientCount, false);
+        for (size_t i = 0; i < clientCount; i++) {
+            short events = fds[i + 2].revents;
+            if (events & (POLLIN | POLLHUP | POLLERR)) {
+                drop[i] = !readClient(_clients[i]);
+            }
+            if (!drop[i] && !_clients[i].output.empty()) {
+                drop[i] = !flushClient(_clients[i]);
+            }
+            if (!drop[i] && _clients[i].output.size() < COMMAND_OUTPUT_LIMIT && _clients[i].input.find('\n') != std::string::npos) {
+                drop[i] = !answerClient(_clients[i]) || !flushClient(_clients[i]); // Requests held back by a full output
+            }
+        }
+        for (size_t i = clientCount; i-- > 0;) {
+            if (drop[i]) {
+                close(_clients[i].fd);
+                _clients.erase(_clients.begin() + i);
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            acceptClients();
+        }
+    }
+}
+
+void CommandServer::acceptClients() {
+    while (true) {
+        int fd = accept4(_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        if (_clients.size() >= COMMAND_MAX_CLIENTS) {
+            static const char busy[] = "error too many clients\n";
+            ssize_t ignored = write(fd, busy, sizeof(busy) - 1);
+            (void)ignored;
+            close(fd);
+            continue;
+        }
+        _clients.push_back(Client{fd, std::string(), std::string(), false});
+    }
+}
+
+bool CommandServer::readClient(Client &client) {
+    char buffer[4096];
+    while (client.input.size() < COMMAND_OUTPUT_LIMIT) { // Past that the rest waits in the socket
+        ssize_t received = read(client.fd, buffer, sizeof(buffer));
+        if (received > 0) {
+            client.input.append(buffer, received);
+            continue;
+        }
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        return false; // Closed or failed
+    }
+    return answerClient(client);
+}
+
+bool CommandServer::answerClient(Client &client) {
+    // Answer complete lines; the responses go out together
+    size_t start = 0;
+    size_t end;
+    while (client.output.size() < COMMAND_OUTPUT_LIMIT && (end = client.input.find('\n', start)) != std::string::npos) {
+        std::string line = client.input.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        handleLine(client, line);
+        start = end + 1;
+    }
+    client.input.erase(0, start);
+    if (client.input.size() > COMMAND_MAX_LINE && client.input.find('\n') == std::string::npos) {
+        client.output += "error line too long\n";
+        flushClient(client);
+        return false;
+    }
+    return true;
+}
+
+bool CommandServer::flushClient(Client &client) {
+    while (!client.output.empty()) {
+        ssize_t sent = send(client.fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+        if (sent > 0) {
+            client.output.erase(0, sent);
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        return sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+}
+
+void CommandServer::handleLine(Client &client, const std::string &line) {
+    std::istringstream words(line);
+    std::string command;
+    words >> command;
+    if (command.empty()) {
+        return; // Blank lines are not requests
+    }
+
+    if (command == "move") {
+        float percent;
+        if (!(words >> percent) || percent < 0 || percent > 100) {
+            client.output += "error move needs a percentage from 0 to 100\n";
+        } else if (!_stepper.isCalibrated()) {
+            client.output += "error not calibrated\n";
+        } else if (!_stepper.moveToStepAsync(static_cast<int>(percent / 100.0f * _stepper.getFullRangeCount()), nullptr)) {
+            client.output += "error queue full\n";
+        } else {
+            client.output += "ok\n";
+        }
+    } else if (command == "step") {
+        int steps;
+        if (!(words >> steps) || steps == 0) {
+            client.output += "error step needs a non-zero step count\n";
+        } else if (!_stepper.isCalibrated()) {
+            client.output += "error not calibrated\n";
+        } else if (!_stepper.moveStepsAsync(std::abs(steps), steps > 0 ? 1 : 0, nullptr)) {
+            client.output += "error queue full\n";
+        } else {
+            client.output += "ok\n";
+        }
+    } else if (command == "stop") {
+        _stepper.stopMovement();
+        client.output += "ok\n";
+    } else if (command == "estop") {
+        _stepper.emergencyStop();
+        client.output += "ok\n";
+    } else if (command == "calibrate") {
+        client.output += _stepper.calibrateAsync(nullptr) ? "ok\n" : "error queue full\n";
+    } else if (command == "rehome") {
+        if (_stepper.getFullRangeCount() <= 0) {
+            client.output += "error not calibrated\n";
+        } else {
+            client.output += _stepper.rehomeAsync(nullptr) ? "ok\n" : "error queue full\n";
+        }
+    } else if (command == "status") {
+        int position = _stepper.getCurrentStepCount();
+        client.output += "status position=" + std::to_string(position) +
+                         " range=" + std::to_string(_stepper.getFullRangeCount()) +
+                         " percent=" + formatPercent(position) +
+                         " moving=" + (_stepper.isMoving() ? "1" : "0") +
+                         " calibrated=" + (_stepper.isCalibrated() ? "1" : "0") +
+                         " trusted=" + (_stepper.isPositionTrusted() ? "1" : "0") +
+                         " alarm=" + (_stepper.getReferenceStats().missedSteps ? "1" : "0") + "\n";
+    } else if (command == "subscribe") {
+        client.subscribed = true;
+        client.output += "ok\n";
+    } else if (command == "unsubscribe") {
+        client.subscribed = false;
+        client.output += "ok\n";
+    } else {
+        client.output += "error unknown command " + command + "\n";
+    }
+}
+
+void CommandServer::publishPosition() {
+    MotionState state = _latest.load();
+    char line[96];
+    std::snprintf(line, sizeof(line), "position %s %d %.1f\n",
+                  formatPercent(state.position).c_str(), state.position, state.velocity);
+    for (Client &client : _clients) {
+        // A slow reader misses updates rather than holding an ever-growing backlog
+        if (client.subscribed && client.output.size() < COMMAND_OUTPUT_LIMIT) {
+            client.output += line;
+        }
+    }
+}
+
+std::string CommandServer::formatPercent(int position) const {
+    int range = _stepper.getFullRangeCount();
+    char text[16];
+    std::snprintf(text, sizeof(text), "%.2f", range > 0 ? position * 100.0f / range : 0.0f);
+    return text;
+}
@@ -0,0 +1,74 @@
+#ifndef CommandServer_h
+#define CommandServer_h
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "PiStepper.h"
+#include "SeqLock.h"
+
+#define COMMAND_SOCKET_PATH "/tmp/motorized_valve.sock"
+#define COMMAND_MAX_CLIENTS 16
+#define COMMAND_MAX_LINE 256 // Longest request line accepted
+#define COMMAND_OUTPUT_LIMIT 65536 // Bytes queued for a client before position updates are skipped and its requests wait
+
+// Text command server on a Unix domain socket. Each request is one line and
+// gets exactly one response line, in order, so a client can write many
+// requests at once and read the responses back together:
+//
+//   move <percent>      Move to a percentage open        -> ok | error ...
+//   step <steps>        Move relative, negative closes   -> ok | error ...
+//   stop                Decelerate and stop              -> ok
+//   estop               Emergency stop                   -> ok
+//   calibrate           Start a calibration              -> ok | error ...
+//   rehome              Re-reference on one switch       -> ok | error ...
+//   status              Current state                    -> status position=.. range=.. percent=.. moving=.. calibrated=..
+//                                                           trusted=.. alarm=..
+//   subscribe           Push position lines              -> ok
+//   unsubscribe         Stop pushing position lines      -> ok
+//
+// Subscribed clients also receive "position <percent> <steps> <velocity>"
+// lines at the stepper's notification rate while it moves and when it
+// stops. The server adds its own motion listener while running, next to
+// any the embedder has set. A path another running server answers on is
+// refused; one left by a server that exited is taken over.
+// Once COMMAND_OUTPUT_LIMIT bytes wait for a client that is not reading,
+// its further requests are left unanswered in the socket until it catches up.
+class CommandServer {
+public:
+    explicit CommandServer(PiStepper &stepper);
+    ~CommandServer();
+
+    bool start(const char *path); // Listen on path and serve from a background thread
+    void stop(); // Disconnect every client and remove the socket
+
+private:
+    struct Client {
+        int fd;
+        std::string input; // Bytes received but not yet a whole line
+        std::string output; // Bytes waiting for the socket to accept them
+        bool subscribed;
+    };
+
+    void run(); // Server thread body
+    void acceptClients();
+    bool readClient(Client &client); // Read and answer what the client sent, false to disconnect
+    bool answerClient(Client &client); // Handle complete lines while the output has room, false to disconnect
+    bool flushClient(Client &client); // Write queued output, false to disconnect
+    void handleLine(Client &client, const std::string &line);
+    void publishPosition(); // Queue the latest motion for subscribers
+    std::string formatPercent(int position) const;
+
+    PiStepper &_stepper;
+    std::string _path;
+    int _listenFd;
+    int _wakeFd; // eventfd, written on new motion and on stop
+    int _listenerId; // From addMotionListener(), 0 while stopped
+    std::atomic<bool> _stopping; // Checked by the server thread after a wake
+    SeqLock<MotionState> _latest; // Motion from the listener, for subscribers
+    std::vector<Client> _clients; // Server thread only
+    std::thread _thread;
+};
+
+#endif // CommandServer_h
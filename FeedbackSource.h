@@ -0,0 +1,13 @@
+#ifndef FeedbackSource_h
+#define FeedbackSource_h
+
+// Measurement of the process variable a PidController regulates, such as
+// flow or pressure downstream of the valve
+class FeedbackSource {
+public:
+    virtual ~FeedbackSource() {}
+
+    virtual bool read(float &value) = 0; // Latest measurement, false if none is available
+};
+
+#endif // FeedbackSource_h
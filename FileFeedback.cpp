@@ -0,0 +1,78 @@
+#include "FileFeedback.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FileFeedback::FileFeedback(const char *path) :
+    _fd(-1),
+    _fifo(false)
+{
+    // O_RDWR keeps a FIFO open when the writer goes away, instead of reading EOF forever
+    struct stat info;
+    _fifo = stat(path, &info) == 0 && S_ISFIFO(info.st_mode);
+    _fd = open(path, (_fifo ? O_RDWR : O_RDONLY) | O_NONBLOCK | O_CLOEXEC);
+    if (_fd < 0) {
+        std::cerr << "Failed to open feedback " << path << ": " << std::strerror(errno) << std::endl;
+    }
+}
+
+FileFeedback::~FileFeedback() {
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+bool FileFeedback::isOpen() const {
+    return _fd >= 0;
+}
+
+bool FileFeedback::read(float &value) {
+    if (_fd < 0) {
+        return false;
+    }
+    return _fifo ? readFifo(value) : readFile(value);
+}
+
+bool FileFeedback::readFifo(float &value) {
+    char buffer[512];
+    ssize_t received;
+    while ((received = ::read(_fd, buffer, sizeof(buffer))) > 0) {
+        _partial.append(buffer, received);
+    }
+
+    // Only the newest complete line matters
+    size_t end = _partial.rfind('\n');
+    if (end != std::string::npos) {
+        size_t start = _partial.rfind('\n', end == 0 ? std::string::npos : end - 1);
+        start = start == std::string::npos ? 0 : start + 1;
+        std::string line = _partial.substr(start, end - start);
+        _partial.erase(0, end + 1);
+        char *parsed;
+        float measurement = std::strtof(line.c_str(), &parsed);
+        if (parsed != line.c_str()) {
+            value = measurement;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FileFeedback::readFile(float &value) {
+    char buffer[64];
+    ssize_t received = pread(_fd, buffer, sizeof(buffer) - 1, 0);
+    if (received <= 0) {
+        return false;
+    }
+    buffer[received] = '\0';
+    char *parsed;
+    float measurement = std::strtof(buffer, &parsed);
+    if (parsed == buffer) {
+        return false;
+    }
+    value = measurement;
+    return true;
+}
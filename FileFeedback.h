@@ -0,0 +1,30 @@
+#ifndef FileFeedback_h
+#define FileFeedback_h
+
+#include <string>
+#include "FeedbackSource.h"
+
+// Reads measurements written as text numbers, one per line, by another
+// process. A FIFO is drained without blocking and its last complete line
+// is used; read() is false when no new line has arrived since the last
+// call, so a writer that stops shows up as missing feedback. A regular
+// file (a sensor export, a sysfs attribute) is re-read from the start on
+// every sample.
+class FileFeedback : public FeedbackSource {
+public:
+    explicit FileFeedback(const char *path);
+    ~FileFeedback() override;
+
+    bool isOpen() const; // Check if the file could be opened
+    bool read(float &value) override;
+
+private:
+    bool readFifo(float &value);
+    bool readFile(float &value);
+
+    int _fd;
+    bool _fifo;
+    std::string _partial; // FIFO bytes after the last newline
+};
+
+#endif // FileFeedback_h
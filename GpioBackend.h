@@ -0,0 +1,96 @@
+#ifndef GpioBackend_h
+#define GpioBackend_h
+
+#include <cstdint>
+
+#define MICROSTEP_MAX 16 // Finest microstep mode the MS1/MS2/MS3 lines can select
+#define LIMIT_POLL_INTERVAL 50 // us between switch reads in waitForLimits() on backends without edge events
+
+// MS1/MS2/MS3 levels selecting a microstep divisor on an A4988 style
+// driver. Returns false for a divisor the driver does not have.
+inline bool microstepLines(int microstepping, int &ms1, int &ms2, int &ms3) {
+    switch (microstepping) {
+        case 1: ms1 = 0; ms2 = 0; ms3 = 0; return true;
+        case 2: ms1 = 1; ms2 = 0; ms3 = 0; return true;
+        case 4: ms1 = 0; ms2 = 1; ms3 = 0; return true;
+        case 8: ms1 = 1; ms2 = 1; ms3 = 0; return true;
+        case 16: ms1 = 1; ms2 = 1; ms3 = 1; return true;
+        default: return false;
+    }
+}
+
+// Microstep divisor selected by MS1/MS2/MS3 levels, the inverse of microstepLines()
+inline int microstepDivisor(int ms1, int ms2, int ms3) {
+    if (ms3) {
+        return 16;
+    }
+    return 1 << ((ms1 ? 1 : 0) + (ms2 ? 2 : 0)); // Half, quarter and eighth
+}
+
+// Hardware access used by PiStepper: the step/dir/enable outputs, the two
+// limit switch inputs and the clock used to time step pulses. Limit switch
+// reads follow the wiring of the valve: 0 means the switch is triggered.
+class GpioBackend {
+public:
+    enum LimitFlag { LimitTop = 1, LimitBottom = 2 };
+
+    virtual ~GpioBackend() {}
+
+    virtual bool isOpen() const = 0; // Check if the lines were acquired
+    virtual void setStep(int value) = 0; // Drive the step line
+    virtual void setDirection(int value) = 0; // Drive the direction line (1 opens the valve)
+    virtual void setEnable(int value) = 0; // Drive the driver enable line
+    virtual int readLimitTop() = 0; // Read the top (fully open) limit switch
+    virtual int readLimitBottom() = 0; // Read the bottom (fully closed) limit switch
+
+    // Batched access for backends that can touch several lines at once
+    virtual void setStepDirection(int step, int direction) { setDirection(direction); setStep(step); }
+    virtual void readLimits(int &top, int &bottom) { top = readLimitTop(); bottom = readLimitBottom(); }
+
+    // LimitFlag bits for switches that are triggered or have been hit since
+    // the last clearLimitLatch(). Backends that watch the switches for edge
+    // events answer from memory; the default polls the lines.
+    virtual int triggeredLimits() {
+        int top, bottom;
+        readLimits(top, bottom);
+        return (top == 0 ? LimitTop : 0) | (bottom == 0 ? LimitBottom : 0);
+    }
+    virtual void clearLimitLatch() {} // Forget switch hits that are no longer active
+    virtual uint64_t limitClosedAt(int /* flag */) { return 0; } // now() time the switch last closed, 0 if not known
+
+    // Sleep until the deadline or until a switch in flags triggers, and
+    // return triggeredLimits(). Backends that watch the switches for edge
+    // events wake on the event; the default reads them every
+    // LIMIT_POLL_INTERVAL us.
+    virtual int waitForLimits(int flags, uint64_t deadline) {
+        int limits = triggeredLimits();
+        while (!(limits & flags)) {
+            uint64_t current = now();
+            if (current >= deadline) {
+                break;
+            }
+            uint64_t poll = current + LIMIT_POLL_INTERVAL * 1000ULL;
+            sleepUntil(poll < deadline ? poll : deadline);
+            limits = triggeredLimits();
+        }
+        return limits;
+    }
+
+    // Drive the driver's microstep select lines, false if they are not wired
+    virtual bool setMicrostepLines(int /* ms1 */, int /* ms2 */, int /* ms3 */) { return false; }
+
+    // Hardware step pulse trains, for backends that can run the step line
+    // from a pulse generator. startPulses() starts a train at 50% duty with
+    // the given period in ns and reports the now() time of its first rising
+    // edge; stopPulses() ends it and returns the number of pulses sent.
+    virtual bool hasPulseGenerator() const { return false; }
+    virtual bool startPulses(uint64_t /* period */, uint64_t & /* firstEdge */) { return false; }
+    virtual int stopPulses() { return 0; }
+
+    virtual uint64_t now() = 0; // Monotonic time in nanoseconds
+    virtual void sleepUntil(uint64_t deadline) = 0; // Sleep until the given now() time
+
+    void sleepFor(uint32_t microseconds) { sleepUntil(now() + microseconds * 1000ULL); }
+};
+
+#endif // GpioBackend_h
@@ -0,0 +1,267 @@
+#include "LibgpiodBackend.h"
+#include <chrono>
+#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+LibgpiodBackend::LibgpiodBackend(const char *chipPath, int stepPin, int dirPin, int enablePin, int limitTopPin, int limitBottomPin,
+                                 int ms1Pin, int ms2Pin, int ms3Pin) :
+    _spinWindow(DEFAULT_SPIN_WINDOW),
+    chip(nullptr),
+    _outputsRequested(false),
+    _inputsRequested(false),
+    _microstepsRequested(false),
+    _outputValues{0, 0, 1},
+    _limitLevel(0),
+    _limitLatch(0),
+    _limitClosedAt{0, 0},
+    _wakeFd(-1)
+{
+    gpiod_line_bulk_init(&outputs);
+    gpiod_line_bulk_init(&inputs);
+    gpiod_line_bulk_init(&microsteps);
+
+    chip = gpiod_chip_open(chipPath);
+    if (!chip) {
+        std::cerr << "Failed to open GPIO chip " << chipPath << std::endl;
+        return;
+    }
+
+    // Configure GPIO pins, ordered to match the Output and Input enums
+    unsigned int outputPins[OutputCount] = {static_cast<unsigned int>(stepPin),
+                                            static_cast<unsigned int>(dirPin),
+                                            static_cast<unsigned int>(enablePin)};
+    unsigned int inputPins[InputCount] = {static_cast<unsigned int>(limitTopPin),
+                                          static_cast<unsigned int>(limitBottomPin)};
+
+    if (gpiod_chip_get_lines(chip, outputPins, OutputCount, &outputs) == 0 &&
+        gpiod_line_request_bulk_output(&outputs, "PiStepper", _outputValues) == 0) {
+        _outputsRequested = true;
+    } else {
+        std::cerr << "Failed to request PiStepper output lines" << std::endl;
+    }
+
+    // Start in full steps, PiStepper selects its mode before the first move
+    if (ms1Pin >= 0 && ms2Pin >= 0 && ms3Pin >= 0) {
+        unsigned int microstepPins[3] = {static_cast<unsigned int>(ms1Pin),
+                                         static_cast<unsigned int>(ms2Pin),
+                                         static_cast<unsigned int>(ms3Pin)};
+        int levels[3] = {0, 0, 0};
+        if (gpiod_chip_get_lines(chip, microstepPins, 3, &microsteps) == 0 &&
+            gpiod_line_request_bulk_output(&microsteps, "PiStepper_microstep", levels) == 0) {
+            _microstepsRequested = true;
+        } else {
+            std::cerr << "Failed to request PiStepper microstep lines" << std::endl;
+        }
+    }
+
+    if (gpiod_chip_get_lines(chip, inputPins, InputCount, &inputs) == 0 &&
+        gpiod_line_request_bulk_both_edges_events(&inputs, "PiStepper_limit") == 0) {
+        _inputsRequested = true;
+    } else {
+        std::cerr << "Failed to request PiStepper limit switch lines" << std::endl;
+        return;
+    }
+
+    // Seed the switch state from the line levels, then follow edge events
+    int top, bottom;
+    readLimits(top, bottom);
+    _limitLevel = (top == 0 ? LimitTop : 0) | (bottom == 0 ? LimitBottom : 0);
+    _limitLatch = _limitLevel.load();
+
+    _wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (_wakeFd < 0) {
+        std::cerr << "Failed to create limit switch watcher" << std::endl;
+        return;
+    }
+    _watcher = std::thread(&LibgpiodBackend::watchLimits, this);
+}
+
+LibgpiodBackend::~LibgpiodBackend() {
+    stopWatcher();
+    if (_outputsRequested) {
+        gpiod_line_release_bulk(&outputs);
+    }
+    if (_inputsRequested) {
+        gpiod_line_release_bulk(&inputs);
+    }
+    if (_microstepsRequested) {
+        gpiod_line_release_bulk(&microsteps);
+    }
+    if (chip) {
+        gpiod_chip_close(chip);
+    }
+}
+
+bool LibgpiodBackend::isOpen() const {
+    return _outputsRequested && _inputsRequested;
+}
+
+void LibgpiodBackend::setStep(int value) {
+    std::lock_guard<std::mutex> lock(_outputMutex);
+    _outputValues[StepLine] = value;
+    writeOutputs();
+}
+
+void LibgpiodBackend::setDirection(int value) {
+    std::lock_guard<std::mutex> lock(_outputMutex);
+    _outputValues[DirLine] = value;
+    writeOutputs();
+}
+
+void LibgpiodBackend::setEnable(int value) {
+    std::lock_guard<std::mutex> lock(_outputMutex);
+    _outputValues[EnableLine] = value;
+    writeOutputs();
+}
+
+void LibgpiodBackend::setStepDirection(int step, int direction) {
+    std::lock_guard<std::mutex> lock(_outputMutex);
+    _outputValues[StepLine] = step;
+    _outputValues[DirLine] = direction;
+    writeOutputs();
+}
+
+int LibgpiodBackend::readLimitTop() {
+    int top, bottom;
+    readLimits(top, bottom);
+    return top;
+}
+
+int LibgpiodBackend::readLimitBottom() {
+    int top, bottom;
+    readLimits(top, bottom);
+    return bottom;
+}
+
+void LibgpiodBackend::readLimits(int &top, int &bottom) {
+    int values[InputCount] = {1, 1}; // Report untriggered if the read fails
+    if (_inputsRequested) {
+        gpiod_line_get_value_bulk(&inputs, values);
+    }
+    top = values[LimitTopLine];
+    bottom = values[LimitBottomLine];
+}
+
+int LibgpiodBackend::triggeredLimits() {
+    if (!_watcher.joinable()) {
+        return GpioBackend::triggeredLimits();
+    }
+    return _limitLevel.load(std::memory_order_relaxed) | _limitLatch.load(std::memory_order_relaxed);
+}
+
+void LibgpiodBackend::clearLimitLatch() {
+    _limitLatch = _limitLevel.load();
+}
+
+uint64_t LibgpiodBackend::limitClosedAt(int flag) {
+    return _limitClosedAt[flag == LimitTop ? LimitTopLine : LimitBottomLine].load(std::memory_order_relaxed);
+}
+
+int LibgpiodBackend::waitForLimits(int flags, uint64_t deadline) {
+    if (!_watcher.joinable()) {
+        return GpioBackend::waitForLimits(flags, deadline);
+    }
+
+    // Sleep on the watcher's notification, then leave the last stretch to
+    // sleepUntil() so the deadline is kept as closely as a step edge
+    {
+        uint64_t wakeAt = deadline > _spinWindow ? deadline - _spinWindow : 0;
+        std::unique_lock<std::mutex> lock(_limitMutex);
+        _limitChanged.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(wakeAt)),
+                                 [&]() { return (triggeredLimits() & flags) != 0; });
+    }
+    int limits = triggeredLimits();
+    if (!(limits & flags)) {
+        sleepUntil(deadline);
+        limits = triggeredLimits();
+    }
+    return limits;
+}
+
+bool LibgpiodBackend::setMicrostepLines(int ms1, int ms2, int ms3) {
+    if (!_microstepsRequested) {
+        return false;
+    }
+    int levels[3] = {ms1, ms2, ms3};
+    std::lock_guard<std::mutex> lock(_outputMutex);
+    return gpiod_line_set_value_bulk(&microsteps, levels) == 0;
+}
+
+void LibgpiodBackend::watchLimits() {
+    const int flags[InputCount] = {LimitTop, LimitBottom};
+    pollfd fds[InputCount + 1];
+    for (int i = 0; i < InputCount; i++) {
+        fds[i].fd = gpiod_line_event_get_fd(gpiod_line_bulk_get_line(&inputs, i));
+        fds[i].events = POLLIN | POLLPRI;
+    }
+    fds[InputCount].fd = _wakeFd;
+    fds[InputCount].events = POLLIN;
+
+    while (true) {
+        if (poll(fds, InputCount + 1, -1) < 0) {
+            continue; // Interrupted by a signal
+        }
+        if (fds[InputCount].revents) {
+            return;
+        }
+        for (int i = 0; i < InputCount; i++) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            gpiod_line_event event;
+            if (gpiod_line_event_read_fd(fds[i].fd, &event) != 0) {
+                continue;
+            }
+            // Switches pull their line low when triggered. Kernels before 5.7
+            // stamp events with CLOCK_REALTIME, use the time it was read then.
+            if (event.event_type == GPIOD_LINE_EVENT_FALLING_EDGE) {
+                uint64_t now = monotonicNow();
+                uint64_t stamp = static_cast<uint64_t>(event.ts.tv_sec) * 1000000000ULL + event.ts.tv_nsec;
+                _limitClosedAt[i] = stamp <= now && now - stamp < 1000000000ULL ? stamp : now;
+                _limitLevel.fetch_or(flags[i]);
+                _limitLatch.fetch_or(flags[i]);
+                {
+                    std::lock_guard<std::mutex> lock(_limitMutex); // A waiter is either asleep or sees the flag
+                }
+                _limitChanged.notify_all();
+            } else {
+                _limitLevel.fetch_and(~flags[i]);
+            }
+        }
+    }
+}
+
+void LibgpiodBackend::stopWatcher() {
+    if (_watcher.joinable()) {
+        uint64_t one = 1;
+        if (write(_wakeFd, &one, sizeof(one)) == sizeof(one)) {
+            _watcher.join();
+        } else {
+            _watcher.detach();
+        }
+    }
+    if (_wakeFd >= 0) {
+        close(_wakeFd);
+        _wakeFd = -1;
+    }
+}
+
+void LibgpiodBackend::writeOutputs() {
+    if (_outputsRequested) {
+        gpiod_line_set_value_bulk(&outputs, _outputValues);
+    }
+}
+
+uint64_t LibgpiodBackend::now() {
+    return monotonicNow();
+}
+
+void LibgpiodBackend::sleepUntil(uint64_t deadline) {
+    sleepUntilDeadline(deadline, _spinWindow);
+}
+
+void LibgpiodBackend::setSpinWindow(uint64_t nanoseconds) {
+    _spinWindow = nanoseconds;
+}
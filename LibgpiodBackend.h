@@ -0,0 +1,76 @@
+#ifndef LibgpiodBackend_h
+#define LibgpiodBackend_h
+
+#include <gpiod.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "GpioBackend.h"
+#include "StepClock.h"
+
+#define GPIO_CHIP_PATH "/dev/gpiochip0"
+
+// GpioBackend for a real valve wired to a Raspberry Pi gpiochip. The three
+// outputs are held in one bulk request and the two limit switches in
+// another, so writing step and direction together or reading both switches
+// costs a single ioctl. The limit switches are requested for edge events
+// and followed by a watcher thread, so the step loop learns about a switch
+// hit from an atomic flag instead of reading the lines on every step.
+// The microstep select lines are optional and held in a bulk of their own.
+class LibgpiodBackend : public GpioBackend {
+public:
+    LibgpiodBackend(const char *chipPath, int stepPin, int dirPin, int enablePin, int limitTopPin, int limitBottomPin,
+                    int ms1Pin = -1, int ms2Pin = -1, int ms3Pin = -1); // MS pins of -1 leave the lines alone
+    ~LibgpiodBackend();
+
+    bool isOpen() const override;
+    void setStep(int value) override;
+    void setDirection(int value) override;
+    void setEnable(int value) override;
+    int readLimitTop() override;
+    int readLimitBottom() override;
+    void setStepDirection(int step, int direction) override;
+    void readLimits(int &top, int &bottom) override;
+    int triggeredLimits() override;
+    void clearLimitLatch() override;
+    uint64_t limitClosedAt(int flag) override;
+    int waitForLimits(int flags, uint64_t deadline) override;
+    bool setMicrostepLines(int ms1, int ms2, int ms3) override;
+
+    uint64_t now() override;
+    void sleepUntil(uint64_t deadline) override;
+
+    void setSpinWindow(uint64_t nanoseconds); // Busy-wait window before each deadline
+
+private:
+    enum Output { StepLine, DirLine, EnableLine, OutputCount };
+    enum Input { LimitTopLine, LimitBottomLine, InputCount };
+
+    void writeOutputs(); // Push _outputValues to all output lines in one call
+    void watchLimits(); // Watcher thread body: poll the switch event fds
+    void stopWatcher();
+
+    uint64_t _spinWindow;
+
+    // GPIO chip and line bulks
+    gpiod_chip *chip;
+    gpiod_line_bulk outputs;
+    gpiod_line_bulk inputs;
+    gpiod_line_bulk microsteps; // MS1, MS2, MS3
+    bool _outputsRequested;
+    bool _inputsRequested;
+    bool _microstepsRequested;
+    int _outputValues[OutputCount]; // Last value written to each output line
+    std::mutex _outputMutex; // Keeps the shadow values and the lines in step
+
+    std::atomic<int> _limitLevel; // LimitFlag bits for switches currently closed
+    std::atomic<int> _limitLatch; // LimitFlag bits for switches closed since the last clear
+    std::atomic<uint64_t> _limitClosedAt[InputCount]; // Time of each switch's last closing edge
+    std::mutex _limitMutex; // Pairs with _limitChanged, the flags themselves are atomic
+    std::condition_variable _limitChanged; // Notified by the watcher when a switch closes
+    int _wakeFd; // eventfd used to stop the watcher
+    std::thread _watcher;
+};
+
+#endif // LibgpiodBackend_h
@@ -0,0 +1,117 @@
+#include "LibgpiodBankIo.h"
+#include <iostream>
+
+LibgpiodBankIo::LibgpiodBankIo(const char *chipPath, const BankChannelPins *pins, int channelCount) :
+    _channelCount(channelCount < MAX_BANK_CHANNELS ? channelCount : MAX_BANK_CHANNELS),
+    _spinWindow(DEFAULT_SPIN_WINDOW),
+    chip(nullptr),
+    _outputsRequested(false),
+    _inputsRequested(false),
+    _outputValues{}
+{
+    gpiod_line_bulk_init(&outputs);
+    gpiod_line_bulk_init(&inputs);
+
+    chip = gpiod_chip_open(chipPath);
+    if (!chip) {
+        std::cerr << "Failed to open GPIO chip " << chipPath << std::endl;
+        return;
+    }
+
+    unsigned int outputPins[3 * MAX_BANK_CHANNELS];
+    unsigned int inputPins[2 * MAX_BANK_CHANNELS];
+    for (int i = 0; i < _channelCount; i++) {
+        outputPins[StepGroup * _channelCount + i] = pins[i].stepPin;
+        outputPins[DirGroup * _channelCount + i] = pins[i].dirPin;
+        outputPins[EnableGroup * _channelCount + i] = pins[i].enablePin;
+        inputPins[i] = pins[i].limitTopPin;
+        inputPins[_channelCount + i] = pins[i].limitBottomPin;
+    }
+
+    if (gpiod_chip_get_lines(chip, outputPins, 3 * _channelCount, &outputs) == 0 &&
+        gpiod_line_request_bulk_output(&outputs, "ValveBank", _outputValues) == 0) {
+        _outputsRequested = true;
+    } else {
+        std::cerr << "Failed to request ValveBank output lines" << std::endl;
+    }
+
+    if (gpiod_chip_get_lines(chip, inputPins, 2 * _channelCount, &inputs) == 0 &&
+        gpiod_line_request_bulk_input(&inputs, "ValveBank_limit") == 0) {
+        _inputsRequested = true;
+    } else {
+        std::cerr << "Failed to request ValveBank limit switch lines" << std::endl;
+    }
+}
+
+LibgpiodBankIo::~LibgpiodBankIo() {
+    if (_outputsRequested) {
+        writeEnables(0);
+        gpiod_line_release_bulk(&outputs);
+    }
+    if (_inputsRequested) {
+        gpiod_line_release_bulk(&inputs);
+    }
+    if (chip) {
+        gpiod_chip_close(chip);
+    }
+}
+
+int LibgpiodBankIo::channelCount() const {
+    return _channelCount;
+}
+
+bool LibgpiodBankIo::isOpen() const {
+    return _outputsRequested && _inputsRequested;
+}
+
+void LibgpiodBankIo::writeSteps(uint32_t mask) {
+    writeGroup(StepGroup, mask);
+}
+
+void LibgpiodBankIo::writeDirections(uint32_t mask) {
+    writeGroup(DirGroup, mask);
+}
+
+void LibgpiodBankIo::writeEnables(uint32_t mask) {
+    writeGroup(EnableGroup, mask);
+}
+
+void LibgpiodBankIo::readLimits(uint32_t &top, uint32_t &bottom) {
+    top = 0;
+    bottom = 0;
+    int values[2 * MAX_BANK_CHANNELS];
+    if (!_inputsRequested || gpiod_line_get_value_bulk(&inputs, values) != 0) {
+        return;
+    }
+    // Switches pull their line low when triggered
+    for (int i = 0; i < _channelCount; i++) {
+        if (values[i] == 0) {
+            top |= 1u << i;
+        }
+        if (values[_channelCount + i] == 0) {
+            bottom |= 1u << i;
+        }
+    }
+}
+
+void LibgpiodBankIo::writeGroup(Group group, uint32_t mask) {
+    int *values = _outputValues + group * _channelCount;
+    for (int i = 0; i < _channelCount; i++) {
+        values[i] = (mask >> i) & 1;
+    }
+    if (_outputsRequested) {
+        gpiod_line_set_value_bulk(&outputs, _outputValues);
+    }
+}
+
+uint64_t LibgpiodBankIo::now() {
+    return monotonicNow();
+}
+
+void LibgpiodBankIo::sleepUntil(uint64_t deadline) {
+    sleepUntilDeadline(deadline, _spinWindow);
+}
+
+void LibgpiodBankIo::setSpinWindow(uint64_t nanoseconds) {
+    _spinWindow = nanoseconds;
+}
@@ -0,0 +1,54 @@
+#ifndef LibgpiodBankIo_h
+#define LibgpiodBankIo_h
+
+#include <gpiod.h>
+#include "BankIo.h"
+#include "StepClock.h"
+
+// GPIO lines of one valve on the bank
+struct BankChannelPins {
+    int stepPin;
+    int dirPin;
+    int enablePin;
+    int limitTopPin;
+    int limitBottomPin;
+};
+
+// BankIo for several valves wired to one gpiochip. All output lines share
+// one bulk request and all limit switches another, so each write or read
+// covers the whole bank in a single ioctl.
+class LibgpiodBankIo : public BankIo {
+public:
+    LibgpiodBankIo(const char *chipPath, const BankChannelPins *pins, int channelCount);
+    ~LibgpiodBankIo();
+
+    int channelCount() const override;
+    bool isOpen() const override;
+    void writeSteps(uint32_t mask) override;
+    void writeDirections(uint32_t mask) override;
+    void writeEnables(uint32_t mask) override;
+    void readLimits(uint32_t &top, uint32_t &bottom) override;
+
+    uint64_t now() override;
+    void sleepUntil(uint64_t deadline) override;
+
+    void setSpinWindow(uint64_t nanoseconds); // Busy-wait window before each deadline
+
+private:
+    // Output lines are ordered steps, then directions, then enables;
+    // inputs are ordered top switches, then bottom switches
+    enum Group { StepGroup, DirGroup, EnableGroup };
+
+    void writeGroup(Group group, uint32_t mask); // Update one group and write every output
+
+    int _channelCount;
+    uint64_t _spinWindow;
+    gpiod_chip *chip;
+    gpiod_line_bulk outputs;
+    gpiod_line_bulk inputs;
+    bool _outputsRequested;
+    bool _inputsRequested;
+    int _outputValues[3 * MAX_BANK_CHANNELS];
+};
+
+#endif // LibgpiodBankIo_h
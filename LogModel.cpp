@@ -0,0 +1,89 @@
+#include "LogModel.h"
+#include <QBrush>
+
+LogModel::LogModel(int capacity, QObject *parent)
+    : QAbstractListModel(parent)
+    , entries(qMax(capacity, 1))
+    , head(0)
+    , count(0)
+{
+}
+
+int LogModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : count;
+}
+
+QVariant LogModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= count) {
+        return QVariant();
+    }
+
+    const Entry &entry = entryAt(index.row());
+    switch (role) {
+        case Qt::DisplayRole:
+            return format(entry);
+        case Qt::ToolTipRole:
+            return entry.timestamp.toString(Qt::ISODateWithMs);
+        case Qt::ForegroundRole:
+            if (entry.severity == Error) {
+                return QBrush(Qt::red);
+            }
+            if (entry.severity == Warning) {
+                return QBrush(QColor(200, 120, 0));
+            }
+            return QVariant();
+        case TimestampRole:
+            return entry.timestamp;
+        case SeverityRole:
+            return static_cast<int>(entry.severity);
+        case MessageRole:
+            return entry.message;
+        default:
+            return QVariant();
+    }
+}
+
+void LogModel::append(Severity severity, const QString &message) {
+    Entry entry{QDateTime::currentDateTime(), severity, message};
+    if (logFile) {
+        logFile->append(format(entry).toStdString());
+    }
+
+    int capacity = entries.size();
+    if (count == capacity) {
+        beginRemoveRows(QModelIndex(), 0, 0);
+        head = (head + 1) % capacity;
+        count--;
+        endRemoveRows();
+    }
+
+    beginInsertRows(QModelIndex(), count, count);
+    entries[(head + count) % capacity] = entry;
+    count++;
+    endInsertRows();
+}
+
+bool LogModel::setLogFile(const QString &path) {
+    logFile.reset();
+    if (path.isEmpty()) {
+        return true;
+    }
+    logFile.reset(new RotatingLogFile(path.toStdString(), LOG_FILE_MAX_BYTES, LOG_FILE_BACKUPS));
+    if (!logFile->isOpen()) {
+        logFile.reset();
+        return false;
+    }
+    return true;
+}
+
+const LogModel::Entry &LogModel::entryAt(int row) const {
+    return entries[(head + row) % entries.size()];
+}
+
+QString LogModel::format(const Entry &entry) {
+    static const char *names[] = {"INFO", "WARN", "ERROR"};
+    return QString("%1 [%2] %3")
+        .arg(entry.timestamp.toString("yyyy-MM-dd hh:mm:ss.zzz"))
+        .arg(names[entry.severity])
+        .arg(entry.message);
+}
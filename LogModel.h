@@ -0,0 +1,55 @@
+#ifndef LOGMODEL_H
+#define LOGMODEL_H
+
+#include <QAbstractListModel>
+#include <QDateTime>
+#include <QVector>
+#include <memory>
+#include "RotatingLogFile.h"
+
+#define LOG_MODEL_CAPACITY 1000 // Messages kept for the log view
+#define LOG_FILE_PATH "/var/tmp/motorized_valve.log"
+
+// List model for the log view holding the most recent messages in a fixed
+// ring buffer. Adding a message inserts one row, and once the buffer is
+// full removes the oldest, so the cost per message stays constant however
+// long the panel runs. Messages can also be copied to a rotating log file
+// written in the background.
+class LogModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    enum Severity { Info, Warning, Error };
+
+    enum Roles {
+        TimestampRole = Qt::UserRole, // QDateTime the message was logged
+        SeverityRole, // Severity as an int
+        MessageRole // Message text without timestamp or severity
+    };
+
+    explicit LogModel(int capacity = LOG_MODEL_CAPACITY, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    void append(Severity severity, const QString &message); // Add a message, dropping the oldest when full
+    bool setLogFile(const QString &path); // Also write messages to a rotating file, empty path to stop
+
+private:
+    struct Entry {
+        QDateTime timestamp;
+        Severity severity;
+        QString message;
+    };
+
+    const Entry &entryAt(int row) const; // Row 0 is the oldest message
+    static QString format(const Entry &entry); // Line shown in the view and written to the file
+
+    QVector<Entry> entries; // Ring buffer, capacity slots
+    int head;               // Slot of the oldest message
+    int count;              // Messages held
+    std::unique_ptr<RotatingLogFile> logFile;
+};
+
+#endif // LOGMODEL_H
@@ -0,0 +1,105 @@
+#include "MotionHandle.h"
+#include <chrono>
+
+const char *motionOutcomeName(MotionResult::Outcome outcome) {
+    switch (outcome) {
+        case MotionResult::Pending: return "pending";
+        case MotionResult::Reached: return "reached";
+        case MotionResult::Redirected: return "redirected";
+        case MotionResult::LimitHit: return "limit-hit";
+        case MotionResult::Stopped: return "stopped";
+        case MotionResult::EmergencyStopped: return "e-stopped";
+        case MotionResult::Discarded: return "discarded";
+        case MotionResult::Failed: return "failed";
+    }
+    return "unknown";
+}
+
+void MotionOperation::complete(const MotionResult &result) {
+    std::function<void(const MotionResult &)> next;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->result = result;
+        next = std::move(continuation);
+        continuation = nullptr;
+    }
+    done.notify_all();
+
+    // Outside the lock, so the continuation can use this handle
+    if (next) {
+        next(result);
+    }
+}
+
+MotionHandle::MotionHandle() {
+}
+
+MotionHandle::MotionHandle(std::shared_ptr<MotionOperation> operation) :
+    _operation(std::move(operation))
+{
+}
+
+bool MotionHandle::isValid() const {
+    return _operation != nullptr;
+}
+
+uint64_t MotionHandle::getId() const {
+    return _operation ? _operation->id.load() : 0;
+}
+
+bool MotionHandle::isDone() const {
+    return getResult().outcome != MotionResult::Pending;
+}
+
+MotionResult MotionHandle::getResult() const {
+    if (!_operation) {
+        return MotionResult();
+    }
+    std::lock_guard<std::mutex> lock(_operation->mutex);
+    return _operation->result;
+}
+
+MotionResult MotionHandle::wait() const {
+    if (!_operation) {
+        return MotionResult();
+    }
+    std::unique_lock<std::mutex> lock(_operation->mutex);
+    _operation->done.wait(lock, [this]() { return _operation->result.outcome != MotionResult::Pending; });
+    return _operation->result;
+}
+
+bool MotionHandle::waitFor(uint32_t milliseconds, MotionResult &result) const {
+    if (!_operation) {
+        result = MotionResult();
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(_operation->mutex);
+    bool ended = _operation->done.wait_for(lock, std::chrono::milliseconds(milliseconds),
+                                           [this]() { return _operation->result.outcome != MotionResult::Pending; });
+    result = _operation->result;
+    return ended;
+}
+
+void MotionHandle::cancel() {
+    if (_operation) {
+        _operation->cancelled = true;
+    }
+}
+
+void MotionHandle::then(std::function<void(const MotionResult &)> continuation) {
+    if (!_operation) {
+        return;
+    }
+    MotionResult result;
+    {
+        std::lock_guard<std::mutex> lock(_operation->mutex);
+        if (_operation->result.outcome == MotionResult::Pending) {
+            _operation->continuation = std::move(continuation);
+            return;
+        }
+        result = _operation->result;
+    }
+    if (continuation) {
+        continuation(result);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef MotionHandle_h
+#define MotionHandle_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// How a motion command ended
+struct MotionResult {
+    enum Outcome {
+        Pending, // Still queued or running
+        Reached, // Arrived at its target, or the calibration or rehome completed
+        Redirected, // Steered to a newer command's target and arrived there
+        LimitHit, // A limit switch ended the move early
+        Stopped, // Ended by stopMovement(), a preempting command or cancel()
+        EmergencyStopped, // Ended or dropped by emergencyStop()
+        Discarded, // Dropped from the queue by a newer command before it ran
+        Failed // Not calibrated, queue full, or homing failed
+    };
+
+    Outcome outcome = Pending;
+    int position = 0; // Step count when the command ended
+    uint64_t elapsed = 0; // Nanoseconds from the worker starting the command to its end, 0 if it never ran
+};
+
+const char *motionOutcomeName(MotionResult::Outcome outcome); // Lower case name, such as "limit-hit"
+
+// State shared by the MotionHandles of a command and the worker running it
+struct MotionOperation {
+    void complete(const MotionResult &result); // Record the result, wake waiters and run the continuation
+
+    std::mutex mutex;
+    std::condition_variable done; // Signalled once result is final
+    MotionResult result; // Guarded by mutex
+    std::function<void(const MotionResult &)> continuation; // Guarded by mutex
+    std::atomic<bool> cancelled{false};
+    std::atomic<uint64_t> id{0}; // Queue id, 0 if the command was never queued
+};
+
+// Refers to one queued motion command. Copies refer to the same command.
+// The result can be polled, waited for, or handed to a continuation that
+// runs on the motion worker the moment the command ends, so supervisory
+// code can chain the next move without polling. Cancelling stops only this
+// command: a queued one is skipped when its turn comes and a running one
+// stops where it is, while anything queued behind it runs as usual.
+class MotionHandle {
+public:
+    MotionHandle();
+    explicit MotionHandle(std::shared_ptr<MotionOperation> operation);
+
+    bool isValid() const; // Refers to a command
+    uint64_t getId() const; // Queue id of the command, 0 if it was never queued
+    bool isDone() const; // The command has ended
+    MotionResult getResult() const; // Outcome Pending until the command ends
+    MotionResult wait() const; // Block until the command ends
+    bool waitFor(uint32_t milliseconds, MotionResult &result) const; // Block for at most the timeout, false if still pending
+
+    void cancel(); // Stop or skip this command only
+
+    // Run continuation once the command ends, on the motion worker, or at
+    // once on this thread if it already has. It may queue further motion but
+    // must not wait for it. Replaces any earlier continuation.
+    void then(std::function<void(const MotionResult &)> continuation);
+
+private:
+    std::shared_ptr<MotionOperation> _operation;
+};
+
+#endif // MotionHandle_h
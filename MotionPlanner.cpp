@@ -0,0 +1,252 @@
+#include "MotionPlanner.h"
+#include <algorithm>
+#include <cmath>
+
+#define RAMP_SEARCH_ITERATIONS 32
+
+MotionPlanner::MotionPlanner() :
+    _steps(0),
+    _stepIndex(0),
+    _maxSpeed(0),
+    _acceleration(0),
+    _jerk(0),
+    _startSpeed(0),
+    _initialSpeed(0),
+    _peakSpeed(0),
+    _entryOffset(0),
+    _exitOffset(0),
+    _currentSpeed(0),
+    _phase(Idle)
+{
+}
+
+void MotionPlanner::plan(int steps, float maxSpeed, float acceleration, float jerk, float startSpeed) {
+    _maxSpeed = maxSpeed;
+    _acceleration = acceleration;
+    _jerk = jerk;
+    _startSpeed = std::min(startSpeed, maxSpeed);
+    replan(steps, _startSpeed);
+}
+
+void MotionPlanner::replan(int steps, float initialSpeed) {
+    _steps = std::max(steps, 0);
+    _stepIndex = 0;
+    _initialSpeed = std::min(std::max(initialSpeed, _startSpeed), _maxSpeed);
+    _currentSpeed = 0;
+    _phase = Idle;
+
+    // Without a usable acceleration the whole move runs at a single speed
+    if (_acceleration <= 0 || _startSpeed >= _maxSpeed) {
+        _peakSpeed = _maxSpeed;
+        _entryOffset = 0;
+        _exitOffset = 0;
+        return;
+    }
+
+    // Lower the peak until both ramps fit inside the move
+    float low = _initialSpeed;
+    float high = _maxSpeed;
+    auto rampsLength = [this](float peak) {
+        return 2 * rampDistance(peak) - rampOffset(_initialSpeed, peak) - rampOffset(_startSpeed, peak);
+    };
+    if (rampsLength(high) > _steps) {
+        for (int i = 0; i < RAMP_SEARCH_ITERATIONS; i++) {
+            float mid = 0.5f * (low + high);
+            if (rampsLength(mid) > _steps) {
+                high = mid;
+            } else {
+                low = mid;
+            }
+        }
+        _peakSpeed = low;
+    } else {
+        _peakSpeed = high;
+    }
+    _entryOffset = rampOffset(_initialSpeed, _peakSpeed);
+    _exitOffset = rampOffset(_startSpeed, _peakSpeed);
+}
+
+int MotionPlanner::brakingSteps(float speed) const {
+    if (_acceleration <= 0 || speed <= _startSpeed) {
+        return 0;
+    }
+    return static_cast<int>(std::ceil(rampDistance(speed) - rampOffset(_startSpeed, speed)));
+}
+
+float MotionPlanner::nextInterval() {
+    if (_stepIndex >= _steps || _peakSpeed <= 0) {
+        _phase = Idle;
+        return 0;
+    }
+
+    float speed = _peakSpeed;
+    _phase = Cruising;
+    if (_acceleration > 0 && _startSpeed < _peakSpeed) {
+        // Sample the profile halfway through the step
+        float travelled = _stepIndex + 0.5f;
+        float up = rampSpeedAt(_entryOffset + travelled);
+        float down = rampSpeedAt(_exitOffset + (_steps - travelled));
+        if (up < speed && up <= down) {
+            speed = up;
+            _phase = Accelerating;
+        } else if (down < speed) {
+            speed = down;
+            _phase = Decelerating;
+        }
+        speed = std::max(speed, _startSpeed);
+    }
+
+    _stepIndex++;
+    _currentSpeed = speed;
+    return 1000000.0f / speed;
+}
+
+int MotionPlanner::stepsRemaining() const {
+    return _steps - _stepIndex;
+}
+
+int MotionPlanner::cruiseStepsRemaining() const {
+    if (_stepIndex >= _steps || _peakSpeed <= 0) {
+        return 0;
+    }
+    int last = _steps - 1;
+    if (_acceleration > 0 && _startSpeed < _peakSpeed) {
+        // Same test as nextInterval(): both ramps have to be at the peak halfway through the step
+        float ramp = rampDistance(_peakSpeed);
+        if (_entryOffset + _stepIndex + 0.5f < ramp) {
+            return 0;
+        }
+        last = static_cast<int>(std::floor(_steps + _exitOffset - ramp - 0.5f));
+    }
+    return std::max(last - _stepIndex + 1, 0);
+}
+
+void MotionPlanner::advance(int steps) {
+    steps = std::min(std::max(steps, 0), _steps - _stepIndex);
+    if (steps == 0) {
+        return;
+    }
+    _stepIndex += steps;
+    _currentSpeed = _peakSpeed;
+    _phase = Cruising;
+}
+
+float MotionPlanner::currentSpeed() const {
+    return _currentSpeed;
+}
+
+float MotionPlanner::peakSpeed() const {
+    return _peakSpeed;
+}
+
+MotionPlanner::Phase MotionPlanner::phase() const {
+    return _phase;
+}
+
+float MotionPlanner::rampSpeedAt(float distance) const {
+    if (distance <= 0) {
+        return 0;
+    }
+    if (distance >= rampDistance(_peakSpeed)) {
+        return _peakSpeed;
+    }
+    if (_jerk <= 0) {
+        return std::sqrt(2 * _acceleration * distance);
+    }
+
+    // Position is monotonic in time along the ramp, so bisect for it
+    float low = 0;
+    float high = rampDuration(_peakSpeed);
+    for (int i = 0; i < RAMP_SEARCH_ITERATIONS; i++) {
+        float mid = 0.5f * (low + high);
+        if (rampPosition(mid, _peakSpeed) < distance) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return rampVelocity(0.5f * (low + high), _peakSpeed);
+}
+
+float MotionPlanner::rampOffset(float speed, float peak) const {
+    if (speed <= 0) {
+        return 0;
+    }
+    if (speed >= peak) {
+        return rampDistance(peak);
+    }
+    if (_jerk <= 0) {
+        return speed * speed / (2 * _acceleration);
+    }
+
+    float low = 0;
+    float high = rampDuration(peak);
+    for (int i = 0; i < RAMP_SEARCH_ITERATIONS; i++) {
+        float mid = 0.5f * (low + high);
+        if (rampVelocity(mid, peak) < speed) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return rampPosition(0.5f * (low + high), peak);
+}
+
+float MotionPlanner::rampDuration(float peak) const {
+    if (_jerk <= 0) {
+        return peak / _acceleration;
+    }
+    if (peak >= _acceleration * _acceleration / _jerk) {
+        return peak / _acceleration + _acceleration / _jerk;
+    }
+    return 2 * std::sqrt(peak / _jerk); // Peak reached before full acceleration
+}
+
+float MotionPlanner::rampDistance(float peak) const {
+    // Both ramp shapes are point-symmetric about their midpoint
+    return 0.5f * peak * rampDuration(peak);
+}
+
+float MotionPlanner::rampPosition(float t, float peak) const {
+    float total = rampDuration(peak);
+    if (t >= total) {
+        return rampDistance(peak);
+    }
+    if (_jerk <= 0) {
+        return 0.5f * _acceleration * t * t;
+    }
+
+    float accel = std::min(_acceleration, std::sqrt(peak * _jerk));
+    float t1 = accel / _jerk;
+    if (t <= t1) {
+        return _jerk * t * t * t / 6;
+    }
+    if (t <= total - t1) {
+        float v1 = 0.5f * accel * t1;
+        float dt = t - t1;
+        return _jerk * t1 * t1 * t1 / 6 + v1 * dt + 0.5f * accel * dt * dt;
+    }
+    float left = total - t;
+    return rampDistance(peak) - (peak * left - _jerk * left * left * left / 6);
+}
+
+float MotionPlanner::rampVelocity(float t, float peak) const {
+    float total = rampDuration(peak);
+    if (t >= total) {
+        return peak;
+    }
+    if (_jerk <= 0) {
+        return _acceleration * t;
+    }
+
+    float accel = std::min(_acceleration, std::sqrt(peak * _jerk));
+    float t1 = accel / _jerk;
+    if (t <= t1) {
+        return 0.5f * _jerk * t * t;
+    }
+    if (t <= total - t1) {
+        return 0.5f * accel * t1 + accel * (t - t1);
+    }
+    float left = total - t;
+    return peak - 0.5f * _jerk * left * left;
+}
@@ -0,0 +1,57 @@
+#ifndef MotionPlanner_h
+#define MotionPlanner_h
+
+// Builds accelerate/cruise/decelerate step timing for a single move.
+// All rates are in steps: speed in steps/s, acceleration in steps/s^2 and
+// jerk in steps/s^3. A jerk of 0 gives a trapezoidal profile, anything
+// greater gives a jerk-limited S-curve.
+class MotionPlanner {
+public:
+    enum Phase { Idle, Accelerating, Cruising, Decelerating };
+
+    MotionPlanner();
+
+    // Plan a move of the given number of steps. The profile starts and ends
+    // at startSpeed and never exceeds maxSpeed.
+    void plan(int steps, float maxSpeed, float acceleration, float jerk, float startSpeed);
+
+    // Re-plan the rest of a move from the current speed with the same
+    // limits, for a move that changes target while running. The new plan
+    // enters at initialSpeed and ends at startSpeed; steps should be at
+    // least brakingSteps(initialSpeed). The entry ramp assumes the
+    // acceleration has settled, so an S-curve is not jerk-limited across
+    // the switch itself.
+    void replan(int steps, float initialSpeed);
+    int brakingSteps(float speed) const; // Steps needed to slow from speed to startSpeed
+
+    float nextInterval(); // Advance one step and return its period in microseconds
+    int stepsRemaining() const; // Steps left in the current plan
+    int cruiseStepsRemaining() const; // Steps from the next one on that run at the peak speed, 0 while accelerating
+    void advance(int steps); // Skip steps taken elsewhere at the peak speed, such as by a hardware pulse train
+    float currentSpeed() const; // Speed of the last step handed out, in steps/s
+    float peakSpeed() const; // Highest speed the plan reaches, in steps/s
+    Phase phase() const; // Phase of the last step handed out
+
+private:
+    float rampSpeedAt(float distance) const; // Speed after travelling distance along the ramp to the peak speed
+    float rampOffset(float speed, float peak) const; // Distance along the ramp to peak at which speed is reached
+    float rampDuration(float peak) const; // Time needed to ramp from rest to peak
+    float rampDistance(float peak) const; // Distance needed to ramp from rest to peak
+    float rampPosition(float t, float peak) const; // Position at time t along the ramp to peak
+    float rampVelocity(float t, float peak) const; // Velocity at time t along the ramp to peak
+
+    int _steps;
+    int _stepIndex;
+    float _maxSpeed;
+    float _acceleration;
+    float _jerk;
+    float _startSpeed;
+    float _initialSpeed;
+    float _peakSpeed;
+    float _entryOffset; // Ramp distance already covered when entering at _initialSpeed
+    float _exitOffset; // Ramp distance left when leaving at _startSpeed
+    float _currentSpeed;
+    Phase _phase;
+};
+
+#endif // MotionPlanner_h
@@ -0,0 +1,96 @@
+#include "MotionQueue.h"
+
+MotionQueue::MotionQueue() :
+    _head(0),
+    _count(0),
+    _nextId(1),
+    _closed(false),
+    _woken(false)
+{
+}
+
+uint64_t MotionQueue::push(const MotionCommand &command, bool discardPending, MotionCommand *discarded, int &discardedCount,
+                           const std::function<void(uint64_t)> &assigned) {
+    discardedCount = 0;
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_closed) {
+            return 0;
+        }
+        if (discardPending) {
+            takeAll(discarded, discardedCount);
+        }
+        if (_count == MOTION_QUEUE_SIZE) {
+            return 0;
+        }
+        MotionCommand &slot = _slots[(_head + _count) % MOTION_QUEUE_SIZE];
+        slot = command;
+        slot.id = id = _nextId++;
+        _count++;
+        if (assigned) {
+            assigned(id);
+        }
+    }
+    _ready.notify_one();
+    return id;
+}
+
+bool MotionQueue::pop(MotionCommand &command, bool &woken) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _ready.wait(lock, [this]() { return _count > 0 || _closed || _woken; });
+    if (_closed) {
+        return false;
+    }
+    woken = _count == 0;
+    _woken = false; // A command wakes the worker as well
+    if (woken) {
+        return true;
+    }
+    command = std::move(_slots[_head]);
+    _slots[_head].callback = nullptr;
+    _head = (_head + 1) % MOTION_QUEUE_SIZE;
+    _count--;
+    return true;
+}
+
+void MotionQueue::clear(MotionCommand *discarded, int &discardedCount) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    takeAll(discarded, discardedCount);
+}
+
+void MotionQueue::wake() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _woken = true;
+    }
+    _ready.notify_one();
+}
+
+void MotionQueue::close() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+    }
+    _ready.notify_all();
+}
+
+uint64_t MotionQueue::lastId() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _nextId - 1;
+}
+
+int MotionQueue::size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _count;
+}
+
+void MotionQueue::takeAll(MotionCommand *discarded, int &discardedCount) {
+    discardedCount = 0;
+    while (_count > 0) {
+        discarded[discardedCount++] = std::move(_slots[_head]);
+        _slots[_head].callback = nullptr;
+        _head = (_head + 1) % MOTION_QUEUE_SIZE;
+        _count--;
+    }
+}
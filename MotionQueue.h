@@ -0,0 +1,69 @@
+#ifndef MotionQueue_h
+#define MotionQueue_h
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#define MOTION_QUEUE_SIZE 8
+
+struct MotionOperation;
+
+// A unit of work for a PiStepper motion worker
+struct MotionCommand {
+    enum Type { MoveSteps, MoveToStep, Calibrate, Rehome, PositionLost };
+
+    Type type = MoveSteps;
+    int steps = 0; // Steps to move for MoveSteps, target step count for MoveToStep
+    int direction = 0; // Direction for MoveSteps (1 opens the valve)
+    std::function<void()> callback; // Invoked once the command has run or been discarded
+    std::shared_ptr<MotionOperation> operation; // Completed with the outcome before the callback, may be null
+    uint64_t id = 0; // Assigned by the queue, increasing in submission order
+};
+
+// Bounded FIFO of motion commands with preallocated slots. One worker
+// thread pops commands; any thread may push.
+class MotionQueue {
+public:
+    // Queue handling for a new command
+    enum Policy {
+        Enqueue, // Run after everything already queued
+        ReplacePending, // Drop queued commands, let the current move finish
+        Preempt // Drop queued commands and stop the current move
+    };
+
+    MotionQueue();
+
+    // Add a command and return its id, or 0 if the queue is full or closed.
+    // With discardPending the queued commands are removed first and moved
+    // into discarded, which must hold MOTION_QUEUE_SIZE entries. assigned,
+    // if set, is called with the new id under the queue lock, before the
+    // worker can take the command or another push can take an id.
+    uint64_t push(const MotionCommand &command, bool discardPending, MotionCommand *discarded, int &discardedCount,
+                  const std::function<void(uint64_t)> &assigned = nullptr);
+    // Wait for the next command or a wake(), false once the queue is closed.
+    // woken is set when the wait ended for a wake() and no command was taken.
+    bool pop(MotionCommand &command, bool &woken);
+    void wake(); // End the worker's current or next wait in pop() without a command
+    void clear(MotionCommand *discarded, int &discardedCount); // Remove all queued commands
+    void close(); // Wake the worker and refuse further commands
+    uint64_t lastId() const; // Id of the most recently accepted command
+    int size() const; // Number of queued commands
+
+private:
+    void takeAll(MotionCommand *discarded, int &discardedCount); // Caller holds _mutex
+
+    std::array<MotionCommand, MOTION_QUEUE_SIZE> _slots;
+    int _head;
+    int _count;
+    uint64_t _nextId;
+    bool _closed;
+    bool _woken;
+    mutable std::mutex _mutex;
+    std::condition_variable _ready;
+};
+
+#endif // MotionQueue_h
@@ -1,121 +1,323 @@
 #include "PiStepper.h"
+#include "LibgpiodBackend.h"
+#include <algorithm>
 #include <cmath>
-#include <unistd.h>
-#include <thread>
 
-PiStepper::PiStepper(int stepPin, int dirPin, int enablePin, int stepsPerRevolution, int microstepping) :
-    _stepPin(stepPin),
-    _dirPin(dirPin),
-    _enablePin(enablePin),
+PiStepper::PiStepper(std::unique_ptr<GpioBackend> backend, int stepsPerRevolution, int microstepping) :
+    _backend(std::move(backend)),
     _stepsPerRevolution(stepsPerRevolution),
     _microstepping(microstepping),
     _speed(DEFAULT_SPEED), // Default speed in RPM
     _acceleration(DEFAULT_ACCELERATION), // Default acceleration in RPM/s
+    _jerk(DEFAULT_JERK), // Default jerk in RPM/s^2
     _currentStepCount(0), // Initialize step counter to 0
     _fullRangeCount(0), // Initialize full range count to 0
     _isMoving(false), // Initialize moving flag to false
-    _isCalibrated(false) // Initialize calibrated flag to false
+    _isCalibrated(false), // Initialize calibrated flag to false
+    _microstepMode(0),
+    _microstepPhase(0),
+    _microstepGrid(0), // The driver may have been left mid-step by an earlier run
+    _positionLost(false),
+    _faults(0),
+    _commandCount(0),
+    _emergencyCount(0),
+    _referenceCount(0),
+    _alarmCount(0),
+    _nextListenerId(1),
+    _lastNotify(0),
+    _queuePolicy(MotionQueue::Enqueue),
+    _realtimeChanged(false),
+    _activeCommand(0),
+    _activeType(MotionCommand::MoveSteps),
+    _retargetTarget(0),
+    _retargetPending(false),
+    _stopBefore(0),
+    _emergencyBefore(0),
+    _activeOperation(nullptr)
 {
-    chip = gpiod_chip_open("/dev/gpiochip0");
-    step_signal = gpiod_chip_get_line(chip, _stepPin);
-    dir_signal = gpiod_chip_get_line(chip, _dirPin);
-    enable_signal = gpiod_chip_get_line(chip, _enablePin);
-    limit_switch_top = gpiod_chip_get_line(chip, LIMIT_SWITCH_TOP_PIN);
-    limit_switch_bottom = gpiod_chip_get_line(chip, LIMIT_SWITCH_BOTTOM_PIN);
-
-    // Configure GPIO pins
-    gpiod_line_request_output(step_signal, "PiStepper_step", 0);
-    gpiod_line_request_output(dir_signal, "PiStepper_dir", 0);
-    gpiod_line_request_output(enable_signal, "PiStepper_enable", 1);
-    gpiod_line_request_input(limit_switch_bottom, "PiStepper_limit_bottom");
-    gpiod_line_request_input(limit_switch_top, "PiStepper_limit_top");
-
     disable(); // Start with the motor disabled
+    _worker = std::thread(&PiStepper::runWorker, this);
 }
 
+PiStepper::PiStepper(int stepPin, int dirPin, int enablePin, int stepsPerRevolution, int microstepping) :
+    PiStepper(std::unique_ptr<GpioBackend>(new LibgpiodBackend(GPIO_CHIP_PATH, stepPin, dirPin, enablePin,
+                                                                LIMIT_SWITCH_TOP_PIN, LIMIT_SWITCH_BOTTOM_PIN)),
+              stepsPerRevolution, microstepping) {}
+
 PiStepper::PiStepper() :
     PiStepper(STEP_PIN, DIR_PIN, ENABLE_PIN, STEPS_PER_REVOLUTION, MICROSTEPPING) {};
 
 PiStepper::~PiStepper() {
-    gpiod_line_release(step_signal);
-    gpiod_line_release(dir_signal);
-    gpiod_line_release(enable_signal);
-    gpiod_line_release(limit_switch_top);
-    gpiod_line_release(limit_switch_bottom);
-    gpiod_chip_close(chip);
+    _stopBefore = UINT64_MAX;
+    _queue.close();
+    _worker.join();
+    disable();
+
+    // Commands still queued never run, complete their handles so nobody waits forever
+    MotionCommand discarded[MOTION_QUEUE_SIZE];
+    int discardedCount;
+    _queue.clear(discarded, discardedCount);
+    for (int i = 0; i < discardedCount; i++) {
+        if (discarded[i].operation) {
+            MotionResult result;
+            result.outcome = MotionResult::Discarded;
+            result.position = getCurrentStepCount();
+            discarded[i].operation->complete(result);
+        }
+    }
+    journalState(!_positionLost, true); // The motor is at rest, so the position can be trusted next start
+    _status.close();
 }
 
 void PiStepper::setSpeed(float speed) {
-    if (speed <= MAX_SPEED) {
-        _speed = speed;
+    if (!(speed > 0) || speed > MAX_SPEED) {
+        std::cerr << "Speed must be above 0 and at most " << MAX_SPEED << " RPM." << std::endl;
+        return;
     }
+    _speed = speed;
 }
 
 void PiStepper::setAcceleration(float acceleration) {
+    if (!(acceleration >= 0) || std::isinf(acceleration)) {
+        std::cerr << "Acceleration must be 0 or more RPM/s." << std::endl;
+        return;
+    }
     _acceleration = acceleration;
 }
 
+void PiStepper::setJerk(float jerk) {
+    if (!(jerk >= 0) || std::isinf(jerk)) {
+        std::cerr << "Jerk must be 0 or more RPM/s^2." << std::endl;
+        return;
+    }
+    _jerk = jerk;
+}
+
+void PiStepper::setRealtime(const RealtimeOptions &options) {
+    {
+        std::lock_guard<std::mutex> lock(_realtimeMutex);
+        _realtime = options;
+    }
+    if (options.enabled && options.lockMemory) {
+        lockProcessMemory();
+    }
+    _realtimeChanged = true; // Picked up by the worker before its next command
+}
+
+void PiStepper::setQueuePolicy(MotionQueue::Policy policy) {
+    _queuePolicy = policy;
+}
+
+void PiStepper::setHoming(const HomingOptions &options) {
+    if (!(options.seekSpeed > 0) || !(options.approachSpeed > 0) || !(options.seekAcceleration >= 0) ||
+        options.backoffSteps <= 0 || options.maxTravel <= 0) {
+        std::cerr << "Homing needs positive speeds, back-off and travel." << std::endl;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_homingMutex);
+    _homing = options;
+    _homing.seekSpeed = std::min(options.seekSpeed, static_cast<float>(MAX_SPEED));
+    _homing.approachSpeed = std::min(options.approachSpeed, static_cast<float>(MAX_SPEED));
+}
+
+void PiStepper::setMicrostepSwitching(const MicrostepOptions &options) {
+    int ms1, ms2, ms3;
+    if (!microstepLines(options.travel, ms1, ms2, ms3)) {
+        std::cerr << "The driver has no 1/" << options.travel << " microstep mode." << std::endl;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_microstepMutex);
+    _microsteps = options;
+    _microsteps.approach = std::max(options.approach, 0);
+}
+
+void PiStepper::setReferencing(const ReferenceOptions &options) {
+    std::lock_guard<std::mutex> lock(_referenceMutex);
+    _referencing = options;
+    _referencing.alarmThreshold = std::max(options.alarmThreshold, 0);
+}
+
 void PiStepper::enable() {
-    gpiod_line_set_value(enable_signal, 1); 
+    _backend->setEnable(1);
 }
 
 void PiStepper::disable() {
-    gpiod_line_set_value(enable_signal, 0); 
+    _backend->setEnable(0);
 }
 
 void PiStepper::moveSteps(int steps, int direction) {
-    {
-        std::lock_guard<std::mutex> lock(gpioMutex);
-        if (!_isCalibrated) {
-            std::cerr << "Calibration is required before moving the motor." << std::endl;
-            return;
-        }
-        _isMoving = true;
+    MotionCommand command;
+    command.type = MotionCommand::MoveSteps;
+    command.steps = steps;
+    command.direction = direction;
+    runAndWait(command);
+}
+
+MotionResult::Outcome PiStepper::executeMove(int target, uint64_t id) {
+    if (!_isCalibrated) {
+        std::cerr << "Calibration is required before moving the motor." << std::endl;
+        return MotionResult::Failed;
     }
-    
+    int requested = target;
+    MotionResult::Outcome outcome = MotionResult::Reached;
+    _retargetPending = false; // Requests aimed at an earlier move are already queued behind it
+
+    // The worker is the only writer of the position and motion state, so
+    // the loop keeps its own copy and publishes it after every step
+    int position = _currentStepCount.load(std::memory_order_relaxed);
+    _isMoving = true;
+    publishState(position, target, 0, MotionPlanner::Accelerating);
+
     enable();
-    gpiod_line_set_value(dir_signal, direction);
+    _backend->clearLimitLatch();
+
+    // Positions stay in fine steps; a coarse pulse covers ratio of them
+    MicrostepOptions microsteps = getMicrostepSwitching();
+    ReferenceOptions referencing = getReferencing();
+    int fine = _microstepping;
+    bool switching = selectMicrostepMode(fine) && microsteps.dynamic && microsteps.travel < fine;
+    int ratio = switching ? fine / microsteps.travel : 1;
+    int approach = microsteps.approach * fine;
+    bool pulseTrains = _backend->hasPulseGenerator();
+
+    // Step edges are scheduled on absolute deadlines so the time spent on
+    // checks and GPIO writes comes out of the step period instead of adding to it
+    MotionPlanner planner;
+    uint64_t deadline = _backend->now();
+    uint32_t stepIndex = 0;
+    bool halted = false;
+    int reached = -1; // Direction of the limit switch the move ran into
+    int overshoot = 0; // Steps a pulse train sent past the switch before it was stopped
 
-    float stepDelay = 60.0 * 1000000 / (_speed * _stepsPerRevolution * _microstepping); // delay in microseconds
+    // Each pass runs one segment in a single direction. When the target is
+    // moved behind the valve, or too close to stop for, the segment
+    // decelerates to a stop and the next pass heads back.
+    while (!halted && position != target) {
+        int direction = target > position ? 1 : 0;
+        _backend->setDirection(direction);
+        planMove(planner, std::abs(target - position));
 
-    for (int i = 0; i < steps; i++) {
-        {
-            std::lock_guard<std::mutex> lock(gpioMutex);
-            if (!_isMoving) {
+        while (planner.stepsRemaining() > 0) {
+            if (stopRequested(id)) {
                 std::cout << "Movement stopped by user." << std::endl;
+                outcome = stopOutcome(id);
+                halted = true;
                 break;
             }
-        }
 
-        if (gpiod_line_get_value(limit_switch_top) == 0 && direction == 1) {
-            std::cout << "Top limit switch triggered" << std::endl;
-            break;
-        }
+            int limits = _backend->triggeredLimits();
+            if ((limits & GpioBackend::LimitTop) && direction == 1) {
+                std::cout << "Top limit switch triggered" << std::endl;
+                outcome = MotionResult::LimitHit;
+                reached = 1;
+                halted = true;
+                break;
+            }
 
-        if (gpiod_line_get_value(limit_switch_bottom) == 0 && direction == 0) {
-            std::cout << "Bottom limit switch triggered" << std::endl;
-            break;
-        }
+            if ((limits & GpioBackend::LimitBottom) && direction == 0) {
+                std::cout << "Bottom limit switch triggered" << std::endl;
+                outcome = MotionResult::LimitHit;
+                reached = 0;
+                halted = true;
+                break;
+            }
 
-        gpiod_line_set_value(step_signal, 1);
-        usleep(stepDelay / 2); // Half delay for pulse high
-        gpiod_line_set_value(step_signal, 0);
-        usleep(stepDelay / 2); // Half delay for pulse low
+            if (_retargetPending.load(std::memory_order_relaxed) && _retargetPending.exchange(false)) {
+                target = _retargetTarget.load(std::memory_order_relaxed);
+                int ahead = direction == 1 ? target - position : position - target;
+                float speed = planner.currentSpeed();
+                planner.replan(std::max(ahead, planner.brakingSteps(speed)), speed);
+                if (planner.stepsRemaining() == 0) {
+                    break;
+                }
+            }
 
-        {
-            std::lock_guard<std::mutex> lock(gpioMutex);
-            if (direction == 0) {
-                _currentStepCount--;
-            } else {
-                _currentStepCount++;
+            // Coarse pulses until the segment nears its end, where it finishes in fine steps.
+            // Coarse mode is only entered from a position on its grid, or the driver would skip.
+            int stride = 1;
+            if (ratio > 1 && planner.stepsRemaining() >= approach + ratio && microstepAligned(microsteps.travel)) {
+                stride = ratio;
+            }
+            if (switching) {
+                selectMicrostepMode(fine / stride);
+            }
+
+            // Long cruises run on the hardware pulse generator, short of any fine approach
+            if (pulseTrains && stride == ratio && stride * 1e9f / planner.peakSpeed() >= PWM_MIN_PERIOD) {
+                int cruise = std::min(planner.cruiseStepsRemaining(),
+                                      planner.stepsRemaining() - (ratio > 1 ? approach : 0));
+                if (cruise >= PWM_MIN_PULSES * stride &&
+                    runPulseTrain(planner, stride, cruise / stride, direction, target, id, deadline, position, stepIndex, overshoot)) {
+                    continue;
+                }
             }
+
+            // The planner runs in fine steps, so a coarse pulse takes the time of all of them
+            uint64_t period = 0; // step period in nanoseconds
+            for (int i = 0; i < stride; i++) {
+                period += planner.nextInterval() * 1000;
+            }
+            uint64_t now = _backend->now();
+            if (now > deadline + period) {
+                _timingStats.recordOverrun();
+                deadline = now; // A whole step behind, resynchronise rather than burst
+            }
+            _backend->sleepUntil(deadline);
+            _backend->setStepDirection(1, direction);
+            uint64_t edge = _backend->now();
+            int64_t lateness = static_cast<int64_t>(edge - deadline);
+            _timingStats.recordEdge(lateness);
+            _backend->sleepUntil(deadline + period / 2); // Half period for pulse high
+            _backend->setStep(0);
+            deadline += period;
+
+            position += direction == 1 ? stride : -stride;
+            advanceMicrostepPhase(direction, stride);
+            _currentStepCount.store(position, std::memory_order_relaxed);
+            publishState(position, target, direction == 1 ? planner.currentSpeed() : -planner.currentSpeed(), planner.phase());
+
+            if (_telemetry.isRecording()) {
+                TelemetryRecord record;
+                record.timestamp = edge;
+                record.stepIndex = stepIndex;
+                record.position = position;
+                record.deadlineError = static_cast<int32_t>(std::max<int64_t>(std::min<int64_t>(lateness, INT32_MAX), INT32_MIN));
+                record.direction = direction;
+                record.limits = limits;
+                record.phase = planner.phase();
+                record.reserved = 0;
+                _telemetry.record(record);
+            }
+            stepIndex++;
         }
     }
-    {
-        std::lock_guard<std::mutex> lock(gpioMutex);
-        _isMoving = false;
+    _backend->sleepUntil(deadline); // Let the last step complete its low half
+
+    // The switch marks the end of the range, whatever the count says
+    if (reached >= 0 && referencing.snapAtLimits) {
+        bool alarm = takeReference(reached, position, !_positionLost, overshoot);
+        if (alarm && referencing.rehomeOnAlarm) {
+            HomingOptions homing = getHoming();
+            uint64_t timeoutAt = homing.timeout ? _backend->now() + homing.timeout * 1000000ULL : UINT64_MAX;
+            int travel;
+            alignMicrostepPhase(reached);
+            if (homeOnLimit(reached, homing, id, timeoutAt, travel)) {
+                position = reached == 1 ? getFullRangeCount() : 0;
+            } else {
+                position = getCurrentStepCount(); // Homing keeps counting, but the switch was not found again
+                _positionLost = true;
+            }
+            _currentStepCount = position;
+        }
     }
+    _isMoving = false;
+    publishState(position, position, 0, MotionPlanner::Idle);
     disable();
+    journalState(false, false);
+    if (!halted && target != requested) {
+        outcome = MotionResult::Redirected;
+    }
+    return outcome;
 }
 
 void PiStepper::moveAngle(float angle, int direction) {
@@ -123,56 +325,347 @@ void PiStepper::moveAngle(float angle, int direction) {
     moveSteps(steps, direction);
 }
 
-void PiStepper::moveStepsAsync(int steps, int direction, std::function<void()> callback) {
-    std::thread([this, steps, direction, callback]() {
-        moveSteps(steps, direction);
-        if (callback) {
-            callback();
-        }
-    }).detach();
+bool PiStepper::moveAngleAsync(float angle, int direction, std::function<void()> callback) {
+    int steps = std::round(angle * ((_stepsPerRevolution * _microstepping) / 360.0f));
+    return moveStepsAsync(steps, direction, std::move(callback));
+}
+
+bool PiStepper::moveStepsAsync(int steps, int direction, std::function<void()> callback) {
+    MotionCommand command;
+    command.type = MotionCommand::MoveSteps;
+    command.steps = steps;
+    command.direction = direction;
+    command.callback = std::move(callback);
+    return submit(command, _queuePolicy) != 0;
 }
 
 void PiStepper::stopMovement() {
-    std::lock_guard<std::mutex> lock(gpioMutex);
-    _isMoving = false;
+    raiseStop(_activeCommand + 1);
 }
 
 void PiStepper::emergencyStop() {
-    std::lock_guard<std::mutex> lock(gpioMutex);
-    _isMoving = false;
     disable();
-    _currentStepCount = 0; // Optionally reset step count
+
+    // Preempt everything with a command that marks the position as lost
+    // once the current move has stopped. The count stays, but the motor may
+    // have slipped with the driver disabled, so it is only trusted again
+    // after the next limit switch or rehome.
+    MotionCommand command;
+    command.type = MotionCommand::PositionLost;
+    submit(command, MotionQueue::Preempt); // Raises the emergency bound to the id it assigns
+    _emergencyCount++; // Published once the worker has run the command
     std::cout << "Emergency Stop Activated!" << std::endl;
 }
 
 void PiStepper::calibrate() {
+    MotionCommand command;
+    command.type = MotionCommand::Calibrate;
+    runAndWait(command);
+}
+
+void PiStepper::rehome() {
+    MotionCommand command;
+    command.type = MotionCommand::Rehome;
+    runAndWait(command);
+}
+
+bool PiStepper::calibrateAsync(std::function<void()> callback) {
+    MotionCommand command;
+    command.type = MotionCommand::Calibrate;
+    command.callback = std::move(callback);
+    return submit(command, _queuePolicy) != 0;
+}
+
+bool PiStepper::rehomeAsync(std::function<void()> callback) {
+    MotionCommand command;
+    command.type = MotionCommand::Rehome;
+    command.callback = std::move(callback);
+    return submit(command, _queuePolicy) != 0;
+}
+
+PiStepper::Restored PiStepper::openJournal(const char *path) {
+    if (!_journal.open(path)) {
+        return RestoredNothing;
+    }
+
+    JournalEntry entry;
+    Restored restored = RestoredNothing;
+    if (_journal.read(entry) && entry.calibrated && entry.fullRange > 0) {
+        _fullRangeCount = entry.fullRange;
+        if (entry.trusted) {
+            _currentStepCount = std::min(std::max(entry.position, 0), entry.fullRange);
+            _isCalibrated = true;
+            publishState(_currentStepCount, _currentStepCount, 0, MotionPlanner::Idle);
+            restored = RestoredPosition;
+        } else {
+            restored = RestoredRange;
+        }
+    }
+
+    // Whatever happens from here on is only trusted again after a clean shutdown
+    journalState(false, true);
+    return restored;
+}
+
+MotionResult::Outcome PiStepper::executeCalibrate(uint64_t id) {
+    HomingOptions homing = getHoming();
+    uint64_t timeoutAt = homing.timeout ? _backend->now() + homing.timeout * 1000000ULL : UINT64_MAX;
+
     enable();
+    _isCalibrated = false;
     _currentStepCount = 0; // Reset step count
     _fullRangeCount = 0; // Reset full range count
 
-    // Move to bottom limit switch
-    gpiod_line_set_value(dir_signal, 0);
-    while (gpiod_line_get_value(limit_switch_bottom) == 1) {
-        gpiod_line_set_value(step_signal, 1);
-        usleep(4000); // Short delay for pulse high
-        gpiod_line_set_value(step_signal, 0);
-        usleep(4000); // Short delay for pulse low
+    // Home on the bottom switch, then measure the range to the top switch
+    // Position is reported relative to the bottom switch once it is found
+    int travel;
+    alignMicrostepPhase(0);
+    bool homed = homeOnLimit(0, homing, id, timeoutAt, travel);
+    if (homed) {
+        _currentStepCount = 0;
+        homed = homeOnLimit(1, homing, id, timeoutAt, travel);
     }
-
-    // Move to top limit switch
-    gpiod_line_set_value(dir_signal, 1);
-    while (gpiod_line_get_value(limit_switch_top) == 1) {
-        gpiod_line_set_value(step_signal, 1);
-        usleep(2000); // Short delay for pulse high
-        gpiod_line_set_value(step_signal, 0);
-        usleep(2000); // Short delay for pulse low
-        _fullRangeCount++;
+    if (!homed) {
+        disable();
+        publishState(getCurrentStepCount(), getCurrentStepCount(), 0, MotionPlanner::Idle);
+        journalState(false, true);
+        std::cerr << "Calibration failed." << std::endl;
+        return stopRequested(id) ? stopOutcome(id) : MotionResult::Failed;
     }
+    int fullRangeCount = travel;
 
-    _currentStepCount = _fullRangeCount; // Set current step count to full range
+    _fullRangeCount = fullRangeCount;
+    _currentStepCount = fullRangeCount; // Set current step count to full range
     _isCalibrated = true; // Set calibrated flag to true
+    _positionLost = false;
+    publishState(fullRangeCount, fullRangeCount, 0, MotionPlanner::Idle);
     disable();
-    std::cout << "Calibration complete. Full range: " << _fullRangeCount << " steps." << std::endl;
+    journalState(false, true);
+    std::cout << "Calibration complete. Full range: " << fullRangeCount << " steps." << std::endl;
+    return MotionResult::Reached;
+}
+
+MotionResult::Outcome PiStepper::executeRehome(uint64_t id) {
+    if (getFullRangeCount() <= 0) {
+        std::cerr << "Calibration is required before rehoming." << std::endl;
+        return MotionResult::Failed;
+    }
+    HomingOptions homing = getHoming();
+    uint64_t timeoutAt = homing.timeout ? _backend->now() + homing.timeout * 1000000ULL : UINT64_MAX;
+
+    // Home on whichever switch is nearer, the range is known either way.
+    // After a restart without a trusted position the count is 0, which
+    // picks the bottom switch.
+    bool trusted = _isCalibrated && !_positionLost;
+    int direction = getCurrentStepCount() > getFullRangeCount() / 2 ? 1 : 0;
+    enable();
+    _isCalibrated = false;
+    if (alignMicrostepPhase(direction)) {
+        trusted = false; // The count no longer covers the aligning pulse
+    }
+    int travel;
+    if (!homeOnLimit(direction, homing, id, timeoutAt, travel)) {
+        disable();
+        publishState(getCurrentStepCount(), getCurrentStepCount(), 0, MotionPlanner::Idle);
+        journalState(false, true);
+        std::cerr << "Rehoming failed." << std::endl;
+        return stopRequested(id) ? stopOutcome(id) : MotionResult::Failed;
+    }
+
+    int position = getCurrentStepCount();
+    takeReference(direction, position, trusted);
+    _isCalibrated = true;
+    publishState(position, position, 0, MotionPlanner::Idle);
+    disable();
+    journalState(false, true);
+    std::cout << "Rehoming complete." << std::endl;
+    return MotionResult::Reached;
+}
+
+bool PiStepper::takeReference(int direction, int &position, bool trusted, int overshoot) {
+    // The switch was seen overshoot steps ago, the valve is that far past it
+    int reference = direction == 1 ? getFullRangeCount() : 0;
+    int drift = position - overshoot - reference;
+    position = reference + overshoot;
+    _currentStepCount = position;
+    _positionLost = false;
+    if (!trusted) {
+        return false; // Nothing to compare against
+    }
+    _referenceCount++;
+
+    std::lock_guard<std::mutex> lock(_referenceMutex);
+    _referenceStats.references++;
+    _referenceStats.lastDrift = drift;
+    _referenceStats.maxDrift = std::max(_referenceStats.maxDrift, std::abs(drift));
+    if (std::abs(drift) <= _referencing.alarmThreshold) {
+        return false;
+    }
+    _referenceStats.alarms++;
+    _referenceStats.missedSteps = true;
+    _alarmCount++;
+    _faults |= FaultMissedSteps;
+    std::cerr << "Missed steps: the " << (direction == 1 ? "top" : "bottom") << " limit switch was "
+              << drift << " steps from the counted position." << std::endl;
+    return true;
+}
+
+bool PiStepper::runPulseTrain(MotionPlanner &planner, int stride, int pulses, int direction, int target, uint64_t id,
+                              uint64_t &deadline, int &position, uint32_t &stepIndex, int &overshoot) {
+    uint64_t period = static_cast<uint64_t>(stride * 1e9f / planner.peakSpeed());
+    _backend->sleepUntil(deadline);
+    uint64_t firstEdge;
+    if (!_backend->startPulses(period, firstEdge)) {
+        return false;
+    }
+
+    // The pulse count comes from the elapsed time, so the train is always
+    // stopped a quarter period before a rising edge, clear of any edge
+    uint64_t stopAt = firstEdge + pulses * period - period / 4;
+    int flag = direction == 1 ? GpioBackend::LimitTop : GpioBackend::LimitBottom;
+    int sign = direction == 1 ? 1 : -1;
+    int origin = position;
+    bool interrupted = false;
+    uint64_t seen = 0; // When the limit switch was found closed
+    while (true) {
+        uint64_t now = _backend->now();
+        if (_backend->triggeredLimits() & flag) {
+            // Every further pulse drives the valve into its end stop, so stop at once instead of at a safe point
+            seen = now;
+            break;
+        }
+        if (now >= stopAt) {
+            break;
+        }
+        if (!interrupted && (stopRequested(id) || _retargetPending.load(std::memory_order_relaxed))) {
+            // Cut the train at the next safe point and let the step loop deal with the cause
+            uint64_t elapsed = now > firstEdge ? now - firstEdge : 0;
+            stopAt = std::min(stopAt, firstEdge + ((elapsed + period / 4) / period + 1) * period - period / 4);
+            interrupted = true;
+            continue;
+        }
+
+        // Publish an estimate while the hardware steps
+        int sent = now > firstEdge ? std::min(static_cast<int>((now - firstEdge) / period) + 1, pulses) : 0;
+        position = origin + sign * sent * stride;
+        _currentStepCount.store(position, std::memory_order_relaxed);
+        publishState(position, target, sign * planner.peakSpeed(), MotionPlanner::Cruising);
+        _backend->waitForLimits(flag, std::min<uint64_t>(stopAt, now + PWM_POLL_INTERVAL * 1000ULL));
+    }
+
+    // A late wake-up lets the train run on; the count includes those pulses
+    int sent = _backend->stopPulses();
+
+    // The pulses after the one that closed the switch took the valve past
+    // it. A pulse cut short has already stepped the driver on its rising
+    // edge and is counted. Without a time from the backend the switch is
+    // taken to have closed when it was seen.
+    if (!seen && (_backend->triggeredLimits() & flag)) {
+        seen = _backend->now(); // Closed while the train was being stopped
+    }
+    if (seen) {
+        uint64_t closed = _backend->limitClosedAt(flag);
+        closed = closed > firstEdge && closed <= seen ? closed : seen;
+        int tripped = static_cast<int>((closed - std::min(closed, firstEdge)) / period) + 1;
+        overshoot = sign * std::max(sent - tripped, 0) * stride;
+    }
+    planner.advance(sent * stride);
+    position = origin + sign * sent * stride;
+    advanceMicrostepPhase(direction, sent * stride);
+    _currentStepCount.store(position, std::memory_order_relaxed);
+    publishState(position, target, sign * planner.peakSpeed(), MotionPlanner::Cruising);
+    deadline = firstEdge + sent * period;
+    stepIndex += sent;
+    return true;
+}
+
+bool PiStepper::homeOnLimit(int direction, const HomingOptions &homing, uint64_t id, uint64_t timeoutAt, int &travel) {
+    int seek, backoff, approach, braked, unused;
+
+    // Fast seek. It ramps down past the switch rather than stopping dead,
+    // since a hard stop at speed can slip the rotor and every step counted
+    // here ends up in the range
+    if (!homingMove(direction, homing.maxTravel, homing.seekSpeed, homing.seekAcceleration, true, id, timeoutAt, seek, braked)) {
+        return false;
+    }
+
+    // Back off over the braking distance until the switch releases
+    if (!homingMove(1 - direction, braked + homing.backoffSteps, homing.seekSpeed, homing.seekAcceleration, false,
+                    id, timeoutAt, backoff, unused)) {
+        return false;
+    }
+    _backend->clearLimitLatch();
+    int flag = direction == 1 ? GpioBackend::LimitTop : GpioBackend::LimitBottom;
+    if (_backend->triggeredLimits() & flag) {
+        std::cerr << "The " << (direction == 1 ? "top" : "bottom") << " limit switch did not release after backing off." << std::endl;
+        return false;
+    }
+
+    // Slow re-approach, the switch should trip within twice the back-off
+    if (!homingMove(direction, 2 * homing.backoffSteps + 1, homing.approachSpeed, 0, true, id, timeoutAt, approach, unused)) {
+        return false;
+    }
+    travel = seek - backoff + approach;
+    return true;
+}
+
+bool PiStepper::homingMove(int direction, int steps, float speed, float acceleration, bool seek,
+                           uint64_t id, uint64_t timeoutAt, int &taken, int &braked) {
+    int flag = direction == 1 ? GpioBackend::LimitTop : GpioBackend::LimitBottom;
+    MotionPlanner planner;
+    planner.plan(steps, rpmToStepRate(speed), rpmToStepRate(acceleration), 0,
+                 rpmToStepRate(std::min(speed, static_cast<float>(START_SPEED))));
+
+    taken = 0;
+    braked = 0;
+    bool tripped = false;
+    selectMicrostepMode(_microstepping); // Homing counts single fine steps
+    _backend->setDirection(direction);
+    _backend->clearLimitLatch();
+    uint64_t deadline = _backend->now();
+    while (planner.stepsRemaining() > 0) {
+        if (stopRequested(id)) {
+            std::cout << "Calibration stopped by user." << std::endl;
+            return false;
+        }
+        if (seek && !tripped && (_backend->triggeredLimits() & flag)) {
+            // Slow to the start speed past the switch, a move without ramps stops at once
+            float speed = planner.currentSpeed();
+            planner.replan(planner.brakingSteps(speed), speed);
+            tripped = true;
+            continue;
+        }
+        if (_backend->now() > timeoutAt) {
+            std::cerr << "Calibration timed out." << std::endl;
+            return false;
+        }
+
+        uint64_t period = planner.nextInterval() * 1000; // step period in nanoseconds
+        uint64_t now = _backend->now();
+        if (now > deadline + period) {
+            deadline = now;
+        }
+        _backend->sleepUntil(deadline);
+        _backend->setStep(1);
+        _backend->sleepUntil(deadline + period / 2);
+        _backend->setStep(0);
+        deadline += period;
+        taken++;
+        braked += tripped ? 1 : 0;
+        advanceMicrostepPhase(direction, 1);
+
+        // Keep position and motion published so listeners can follow the homing
+        int position = getCurrentStepCount() + (direction == 1 ? 1 : -1);
+        _currentStepCount.store(position, std::memory_order_relaxed);
+        publishState(position, position, direction == 1 ? planner.currentSpeed() : -planner.currentSpeed(), planner.phase());
+    }
+    _backend->sleepUntil(deadline);
+    if (seek && !(_backend->triggeredLimits() & flag)) {
+        std::cerr << "The " << (direction == 1 ? "top" : "bottom") << " limit switch was not reached within "
+                  << steps << " steps." << std::endl;
+        return false;
+    }
+    return true;
 }
 
 void PiStepper::setMicrostepping(int microstepping) {
@@ -180,23 +673,82 @@ void PiStepper::setMicrostepping(int microstepping) {
 }
 
 int PiStepper::getCurrentStepCount() const {
-    std::lock_guard<std::mutex> lock(gpioMutex);
-    return _currentStepCount;
+    return _currentStepCount.load(std::memory_order_relaxed);
 }
 
 int PiStepper::getFullRangeCount() const {
-    std::lock_guard<std::mutex> lock(gpioMutex);
-    return _fullRangeCount;
+    return _fullRangeCount.load(std::memory_order_relaxed);
 }
 
 float PiStepper::getPercentOpen() const {
-    std::lock_guard<std::mutex> lock(gpioMutex);
-    return (_currentStepCount / static_cast<float>(_fullRangeCount)) * 100.0f;
+    return (getCurrentStepCount() / static_cast<float>(getFullRangeCount())) * 100.0f;
 }
 
 bool PiStepper::isMoving() const {
-    std::lock_guard<std::mutex> lock(gpioMutex);
-    return _isMoving;
+    return _isMoving.load(std::memory_order_relaxed);
+}
+
+bool PiStepper::isCalibrated() const {
+    return _isCalibrated.load(std::memory_order_relaxed);
+}
+
+MotionState PiStepper::getMotionState() const {
+    return _motionState.load();
+}
+
+bool PiStepper::isPositionTrusted() const {
+    return !_positionLost.load(std::memory_order_relaxed);
+}
+
+ReferenceStats PiStepper::getReferenceStats() const {
+    std::lock_guard<std::mutex> lock(_referenceMutex);
+    return _referenceStats;
+}
+
+void PiStepper::clearMissedStepAlarm() {
+    {
+        std::lock_guard<std::mutex> lock(_referenceMutex);
+        _referenceStats = ReferenceStats();
+        _faults &= ~FaultMissedSteps;
+    }
+    requestStatus();
+}
+
+void PiStepper::setMotionListener(std::function<void(const MotionState &)> listener) {
+    std::lock_guard<std::mutex> lock(_listenerMutex);
+    _motionListener = std::move(listener);
+}
+
+int PiStepper::addMotionListener(std::function<void(const MotionState &)> listener) {
+    std::lock_guard<std::mutex> lock(_listenerMutex);
+    int id = _nextListenerId++;
+    _addedListeners[id] = std::move(listener);
+    return id;
+}
+
+void PiStepper::removeMotionListener(int id) {
+    std::lock_guard<std::mutex> lock(_listenerMutex);
+    _addedListeners.erase(id);
+}
+
+StepTimingSnapshot PiStepper::getTimingStats() const {
+    return _timingStats.snapshot();
+}
+
+void PiStepper::resetTimingStats() {
+    _timingStats.reset();
+}
+
+bool PiStepper::startTelemetry(const char *path) {
+    return _telemetry.start(path);
+}
+
+void PiStepper::stopTelemetry() {
+    _telemetry.stop();
+}
+
+uint64_t PiStepper::getDroppedTelemetry() const {
+    return _telemetry.droppedRecords();
 }
 
 void PiStepper::moveToPercentOpen(float percent, std::function<void()> callback) {
@@ -204,10 +756,12 @@ void PiStepper::moveToPercentOpen(float percent, std::function<void()> callback)
         std::cerr << "Calibration is required before moving the motor." << std::endl;
         return;
     }
-    int targetStepCount = static_cast<int>((percent / 100.0f) * _fullRangeCount);
-    int stepsToMove = targetStepCount - _currentStepCount;
-    int direction = (stepsToMove >= 0) ? 1 : 0;
-    moveStepsAsync(abs(stepsToMove), direction, callback);
+    if (!std::isfinite(percent)) {
+        std::cerr << "Percent open must be a finite number." << std::endl;
+        return;
+    }
+    percent = std::min(std::max(percent, 0.0f), 100.0f); // In range before the cast
+    moveToStepAsync(static_cast<int>((percent / 100.0f) * _fullRangeCount), std::move(callback));
 }
 
 void PiStepper::moveToFullyOpen() {
@@ -215,11 +769,9 @@ void PiStepper::moveToFullyOpen() {
         std::cerr << "Calibration is required before moving the motor." << std::endl;
         return;
     }
-    moveStepsAsync(_fullRangeCount - _currentStepCount, 1, [this]() {
+    moveToStepAsync(_fullRangeCount, []() {
         std::cout << "Motor moved to fully open position." << std::endl;
     });
-    
-    // moveSteps(_fullRangeCount - _currentStepCount, 1);
 }
 
 void PiStepper::moveToFullyClosed() {
@@ -227,11 +779,72 @@ void PiStepper::moveToFullyClosed() {
         std::cerr << "Calibration is required before moving the motor." << std::endl;
         return;
     }
-    moveStepsAsync(_currentStepCount, 0, [this]() {
+    moveToStepAsync(0, []() {
         std::cout << "Motor moved to fully closed position." << std::endl;
     });
+}
+
+bool PiStepper::moveToStepAsync(int target, std::function<void()> callback) {
+    return moveToStepAsync(target, _queuePolicy, std::move(callback));
+}
+
+bool PiStepper::moveToStepAsync(int target, MotionQueue::Policy policy, std::function<void()> callback) {
+    // The distance is worked out when the worker reaches the command, so
+    // moves queued behind other moves start from the right position
+    MotionCommand command;
+    command.type = MotionCommand::MoveToStep;
+    command.steps = std::min(std::max(target, 0), getFullRangeCount());
+    command.callback = std::move(callback);
+    return submitMoveTo(command, policy) != 0;
+}
+
+MotionHandle PiStepper::moveStepsAsync(int steps, int direction) {
+    MotionCommand command;
+    command.type = MotionCommand::MoveSteps;
+    command.steps = steps;
+    command.direction = direction;
+    return submitTracked(command, _queuePolicy);
+}
+
+MotionHandle PiStepper::moveAngleAsync(float angle, int direction) {
+    int steps = std::round(angle * ((_stepsPerRevolution * _microstepping) / 360.0f));
+    return moveStepsAsync(steps, direction);
+}
+
+MotionHandle PiStepper::moveToStepAsync(int target) {
+    return moveToStepAsync(target, _queuePolicy);
+}
+
+MotionHandle PiStepper::moveToStepAsync(int target, MotionQueue::Policy policy) {
+    MotionCommand command;
+    command.type = MotionCommand::MoveToStep;
+    command.steps = std::min(std::max(target, 0), getFullRangeCount());
+    return submitTracked(command, policy);
+}
+
+MotionHandle PiStepper::moveToPercentOpen(float percent) {
+    if (!_isCalibrated) {
+        std::cerr << "Calibration is required before moving the motor." << std::endl;
+        return rejected();
+    }
+    if (!std::isfinite(percent)) {
+        std::cerr << "Percent open must be a finite number." << std::endl;
+        return rejected();
+    }
+    percent = std::min(std::max(percent, 0.0f), 100.0f); // In range before the cast
+    return moveToStepAsync(static_cast<int>((percent / 100.0f) * _fullRangeCount));
+}
 
-    // moveSteps(_currentStepCount, 0);
+MotionHandle PiStepper::calibrateAsync() {
+    MotionCommand command;
+    command.type = MotionCommand::Calibrate;
+    return submitTracked(command, _queuePolicy);
+}
+
+MotionHandle PiStepper::rehomeAsync() {
+    MotionCommand command;
+    command.type = MotionCommand::Rehome;
+    return submitTracked(command, _queuePolicy);
 }
 
 int PiStepper::getStepsPerRevolution() const {
@@ -249,3 +862,363 @@ float PiStepper::getSpeed() const {
 float PiStepper::getAcceleration() const {
     return _acceleration;
 }
+
+float PiStepper::getJerk() const {
+    return _jerk;
+}
+
+RealtimeOptions PiStepper::getRealtime() const {
+    std::lock_guard<std::mutex> lock(_realtimeMutex);
+    return _realtime;
+}
+
+MotionQueue::Policy PiStepper::getQueuePolicy() const {
+    return _queuePolicy;
+}
+
+HomingOptions PiStepper::getHoming() const {
+    std::lock_guard<std::mutex> lock(_homingMutex);
+    return _homing;
+}
+
+MicrostepOptions PiStepper::getMicrostepSwitching() const {
+    std::lock_guard<std::mutex> lock(_microstepMutex);
+    return _microsteps;
+}
+
+ReferenceOptions PiStepper::getReferencing() const {
+    std::lock_guard<std::mutex> lock(_referenceMutex);
+    return _referencing;
+}
+
+uint64_t PiStepper::submit(const MotionCommand &command, MotionQueue::Policy policy) {
+    MotionCommand discarded[MOTION_QUEUE_SIZE];
+    int discardedCount;
+    // Commands stopped for an emergency have lower ids than its reset. The
+    // bound is raised from the id the reset actually gets, before the stop
+    // bound below, so the move it stops already reads as an emergency.
+    uint64_t id = command.type == MotionCommand::PositionLost ?
+        _queue.push(command, policy != MotionQueue::Enqueue, discarded, discardedCount,
+                    [this](uint64_t assigned) { raiseBound(_emergencyBefore, assigned); }) :
+        _queue.push(command, policy != MotionQueue::Enqueue, discarded, discardedCount);
+    if (id == 0) {
+        std::cerr << "Motion queue is full, command dropped." << std::endl;
+    } else if (policy == MotionQueue::Preempt) {
+        raiseStop(id); // Stops whatever is running ahead of the new command
+    }
+    if (id != 0 && command.operation) {
+        command.operation->id = id;
+    }
+    runCallbacks(discarded, discardedCount, command.type == MotionCommand::PositionLost ?
+                 MotionResult::EmergencyStopped : MotionResult::Discarded);
+    return id;
+}
+
+uint64_t PiStepper::submitMoveTo(const MotionCommand &command, MotionQueue::Policy policy) {
+    // A move under way is steered to the new target instead of being
+    // stopped and restarted: it re-plans from its current speed and ends at
+    // the target, where the queued command finishes with nothing left to do.
+    // Without a preempting policy only an absolute move with nothing queued
+    // behind it is steered, so queued work keeps its order.
+    bool steer = _isMoving && (policy != MotionQueue::Enqueue ||
+                               (_activeType == MotionCommand::MoveToStep && _queue.size() == 0));
+    if (!steer) {
+        return submit(command, policy);
+    }
+    uint64_t id = submit(command, policy == MotionQueue::Preempt ? MotionQueue::ReplacePending : policy);
+    if (id == 0) {
+        return 0;
+    }
+    _retargetTarget.store(command.steps, std::memory_order_relaxed);
+    _retargetPending = true;
+    return id;
+}
+
+MotionHandle PiStepper::submitTracked(MotionCommand &command, MotionQueue::Policy policy) {
+    std::shared_ptr<MotionOperation> operation = std::make_shared<MotionOperation>();
+    command.operation = operation;
+    uint64_t id = command.type == MotionCommand::MoveToStep ? submitMoveTo(command, policy) : submit(command, policy);
+    if (id == 0) {
+        MotionResult result;
+        result.outcome = MotionResult::Failed;
+        result.position = getCurrentStepCount();
+        operation->complete(result);
+    }
+    return MotionHandle(operation);
+}
+
+MotionHandle PiStepper::rejected() {
+    std::shared_ptr<MotionOperation> operation = std::make_shared<MotionOperation>();
+    MotionResult result;
+    result.outcome = MotionResult::Failed;
+    result.position = getCurrentStepCount();
+    operation->complete(result);
+    return MotionHandle(operation);
+}
+
+void PiStepper::runAndWait(MotionCommand &command) {
+    if (std::this_thread::get_id() == _worker.get_id()) {
+        command.id = _activeCommand; // Called from a completion callback, already on the worker
+        execute(command);
+        return;
+    }
+
+    // Block until the worker has run (or discarded) the command
+    struct Waiter {
+        std::mutex mutex;
+        std::condition_variable done;
+        bool finished = false;
+    } waiter;
+    Waiter *state = &waiter;
+    command.callback = [state]() {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->finished = true;
+        state->done.notify_one();
+    };
+    if (submit(command, _queuePolicy) == 0) {
+        // Nothing ran, which the blocking callers cannot otherwise tell from a finished command
+        std::cerr << (command.type == MotionCommand::Calibrate ? "Calibration" :
+                      command.type == MotionCommand::Rehome ? "Rehome" : "Move")
+                  << " was not queued and did not run." << std::endl;
+        return;
+    }
+    std::unique_lock<std::mutex> lock(waiter.mutex);
+    waiter.done.wait(lock, [state]() { return state->finished; });
+}
+
+void PiStepper::runWorker() {
+    MotionCommand command;
+    bool woken;
+    while (_queue.pop(command, woken)) {
+        if (_realtimeChanged.exchange(false)) {
+            applyRealtime(getRealtime()); // A copy, so the caller can set new options meanwhile
+        }
+        if (woken) {
+            publishStatus(getMotionState()); // Another thread changed a flag or counter
+            continue;
+        }
+        _activeCommand = command.id;
+        _activeType = command.type;
+        _activeOperation = command.operation.get();
+
+        // A cancelled command is skipped, the ones behind it run as usual
+        MotionResult result;
+        if (command.operation && command.operation->cancelled) {
+            result.outcome = MotionResult::Stopped;
+        } else {
+            uint64_t start = _backend->now();
+            result.outcome = execute(command);
+            result.elapsed = _backend->now() - start;
+        }
+        result.position = getCurrentStepCount();
+        _activeOperation = nullptr;
+        if (result.outcome == MotionResult::Failed) {
+            _faults |= FaultCommandFailed;
+        } else {
+            _faults &= ~FaultCommandFailed;
+        }
+        _commandCount++;
+        publishStatus(getMotionState());
+
+        if (command.operation) {
+            command.operation->complete(result);
+        }
+        if (command.callback) {
+            command.callback();
+        }
+        command.callback = nullptr;
+        command.operation.reset();
+    }
+}
+
+MotionResult::Outcome PiStepper::execute(const MotionCommand &command) {
+    switch (command.type) {
+        case MotionCommand::MoveSteps:
+            return executeMove(getCurrentStepCount() + (command.direction == 1 ? command.steps : -command.steps), command.id);
+        case MotionCommand::MoveToStep:
+            return executeMove(command.steps, command.id);
+        case MotionCommand::Calibrate:
+            return executeCalibrate(command.id);
+        case MotionCommand::Rehome:
+            return executeRehome(command.id);
+        case MotionCommand::PositionLost:
+            _positionLost = true;
+            journalState(false, false);
+            break;
+    }
+    return MotionResult::Reached;
+}
+
+bool PiStepper::stopRequested(uint64_t id) const {
+    return id < _stopBefore.load(std::memory_order_relaxed) ||
+           (_activeOperation && _activeOperation->cancelled.load(std::memory_order_relaxed));
+}
+
+MotionResult::Outcome PiStepper::stopOutcome(uint64_t id) const {
+    return id < _emergencyBefore.load() ? MotionResult::EmergencyStopped : MotionResult::Stopped;
+}
+
+void PiStepper::publishState(int position, int target, float velocity, MotionPlanner::Phase phase) {
+    MotionState state;
+    state.position = position;
+    state.target = target;
+    state.velocity = velocity;
+    state.phase = phase;
+    state.timestamp = _backend->now();
+    _motionState.store(state);
+    if (std::this_thread::get_id() == _worker.get_id()) {
+        publishStatus(state);
+    } else {
+        requestStatus(); // openJournal() restores the position on the caller's thread
+    }
+
+    // Coalesce per-step updates down to the notification rate
+    if (phase == MotionPlanner::Idle || state.timestamp - _lastNotify >= MOTION_NOTIFY_INTERVAL * 1000000ULL) {
+        _lastNotify = state.timestamp;
+        std::lock_guard<std::mutex> lock(_listenerMutex);
+        if (_motionListener) {
+            _motionListener(state);
+        }
+        for (const auto &listener : _addedListeners) {
+            listener.second(state);
+        }
+    }
+}
+
+bool PiStepper::openStatusSegment(const char *name) {
+    if (!_status.open(name)) {
+        return false;
+    }
+    requestStatus();
+    return true;
+}
+
+void PiStepper::requestStatus() {
+    _queue.wake();
+}
+
+void PiStepper::publishStatus(const MotionState &state) {
+    if (!_status.isOpen()) {
+        return;
+    }
+    ValveStatus status;
+    status.position = state.position;
+    status.target = state.target;
+    status.fullRange = getFullRangeCount();
+    status.percentOpen = status.fullRange > 0 ? state.position * 100.0f / status.fullRange : 0;
+    status.velocity = state.velocity;
+    status.phase = state.phase;
+    status.flags = (state.phase != MotionPlanner::Idle ? StatusMoving : 0) | (isCalibrated() ? StatusCalibrated : 0);
+    status.faults = _faults.load(std::memory_order_relaxed) | (_positionLost ? FaultPositionLost : 0);
+    status.commands = _commandCount.load(std::memory_order_relaxed);
+    status.emergencyStops = _emergencyCount.load(std::memory_order_relaxed);
+    status.references = _referenceCount.load(std::memory_order_relaxed);
+    status.alarms = _alarmCount.load(std::memory_order_relaxed);
+    status.timestamp = monotonicNow(); // The backend clock may be virtual, readers need a shared one
+    _status.publish(status); // Only the worker publishes, so the stores come in state order
+}
+
+void PiStepper::journalState(bool trusted, bool sync) {
+    if (!_journal.isOpen()) {
+        return;
+    }
+    JournalEntry entry;
+    entry.fullRange = getFullRangeCount();
+    entry.position = getCurrentStepCount();
+    entry.calibrated = entry.fullRange > 0; // The range survives a lost position
+    entry.trusted = trusted && _isCalibrated;
+    _journal.write(entry, sync);
+}
+
+bool PiStepper::selectMicrostepMode(int microstepping) {
+    if (microstepping == _microstepMode) {
+        return true;
+    }
+    int ms1, ms2, ms3;
+    if (!microstepLines(microstepping, ms1, ms2, ms3) || !_backend->setMicrostepLines(ms1, ms2, ms3)) {
+        _microstepMode = 0;
+        return false;
+    }
+    _microstepMode = microstepping;
+    return true;
+}
+
+void PiStepper::advanceMicrostepPhase(int direction, int steps) {
+    if (_microstepMode == 0) {
+        return;
+    }
+    // One electrical cycle is four full steps; the phase wraps there
+    int cycle = 4 * MICROSTEP_MAX;
+    int units = steps * (MICROSTEP_MAX / _microstepping);
+    _microstepPhase = ((_microstepPhase + (direction == 1 ? units : -units)) % cycle + cycle) % cycle;
+}
+
+bool PiStepper::microstepAligned(int microstepping) const {
+    return _microstepGrid != 0 && microstepping >= _microstepGrid &&
+           _microstepPhase % (MICROSTEP_MAX / microstepping) == 0;
+}
+
+bool PiStepper::alignMicrostepPhase(int direction) {
+    MicrostepOptions microsteps = getMicrostepSwitching();
+    int travel = microsteps.travel;
+    if (!microsteps.dynamic || travel >= _microstepping || (_microstepGrid != 0 && travel >= _microstepGrid)) {
+        return false; // Coarse mode is never used, or the phase is already known against its grid
+    }
+    if (!selectMicrostepMode(travel)) {
+        return false;
+    }
+
+    // A coarse pulse from anywhere ends on the coarse grid, after an unknown
+    // part of a coarse step. Take it away from the switch about to be homed
+    // on, whose re-approach then sets the position, unless that end is closed.
+    int away = 1 - direction;
+    if (_backend->triggeredLimits() & (away == 1 ? GpioBackend::LimitTop : GpioBackend::LimitBottom)) {
+        away = direction;
+    }
+    uint64_t period = static_cast<uint64_t>(_microstepping / travel * 1e9f / rpmToStepRate(START_SPEED));
+    uint64_t deadline = _backend->now();
+    _backend->setDirection(away);
+    _backend->setStep(1);
+    _backend->sleepUntil(deadline + period / 2);
+    _backend->setStep(0);
+    _backend->sleepUntil(deadline + period);
+    _microstepPhase = 0;
+    _microstepGrid = travel;
+    return true;
+}
+
+void PiStepper::raiseStop(uint64_t before) {
+    raiseBound(_stopBefore, before);
+}
+
+void PiStepper::raiseBound(std::atomic<uint64_t> &bound, uint64_t value) {
+    uint64_t current = bound;
+    while (value > current && !bound.compare_exchange_weak(current, value)) {
+    }
+}
+
+void PiStepper::runCallbacks(MotionCommand *commands, int count, MotionResult::Outcome outcome) {
+    for (int i = 0; i < count; i++) {
+        if (commands[i].operation) {
+            MotionResult result;
+            result.outcome = outcome;
+            result.position = getCurrentStepCount();
+            commands[i].operation->complete(result);
+        }
+        if (commands[i].callback) {
+            commands[i].callback();
+        }
+    }
+}
+
+float PiStepper::rpmToStepRate(float rpm) const {
+    return rpm * _stepsPerRevolution * _microstepping / 60.0f;
+}
+
+void PiStepper::planMove(MotionPlanner &planner, int steps) const {
+    planner.plan(steps,
+                 rpmToStepRate(_speed),
+                 rpmToStepRate(_acceleration),
+                 rpmToStepRate(_jerk),
+                 rpmToStepRate(START_SPEED));
+}
@@ -1,10 +1,23 @@
 #ifndef PiStepper_h
 #define PiStepper_h
 
-#include <gpiod.h>
+#include <atomic>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <functional>
+#include <thread>
+#include "GpioBackend.h"
+#include "MotionHandle.h"
+#include "MotionPlanner.h"
+#include "MotionQueue.h"
+#include "SeqLock.h"
+#include "StateJournal.h"
+#include "StatusSegment.h"
+#include "StepClock.h"
+#include "StepTimingStats.h"
+#include "TelemetryRecorder.h"
 
 #define LIMIT_SWITCH_BOTTOM_PIN 21
 #define LIMIT_SWITCH_TOP_PIN 20
@@ -12,78 +25,296 @@
 #define MICROSTEPPING 1
 #define DEFAULT_SPEED 20
 #define DEFAULT_ACCELERATION 80
+#define DEFAULT_JERK 0 // RPM/s^2, 0 selects a trapezoidal profile
+#define START_SPEED 5 // RPM the motor can start and stop at without ramping
 #define STEP_PIN 17
 #define DIR_PIN 27
 #define ENABLE_PIN 22
-#define MAX_SPEED 50
+#define MS1_PIN 5
+#define MS2_PIN 6
+#define MS3_PIN 13
+#define MAX_SPEED 150
+#define MOTION_NOTIFY_INTERVAL 20 // ms between motion notifications while moving
+#define HOMING_SEEK_SPEED 120 // RPM for the fast seek toward a limit switch, at most MAX_SPEED
+#define HOMING_SEEK_ACCELERATION 600 // RPM/s for the fast seek and the back-off
+#define HOMING_APPROACH_SPEED 15 // RPM for the slow re-approach that sets the reference
+#define HOMING_BACKOFF_STEPS 8 // Steps to back off a switch before re-approaching it
+#define HOMING_MAX_TRAVEL 20000 // Steps a seek may take before calibration gives up
+#define HOMING_TIMEOUT 30000 // ms a whole calibration may take
+#define MICROSTEP_TRAVEL 1 // Microstepping used to cover distance, 1 for full steps
+#define MICROSTEP_APPROACH 2 // Full steps before the end of a move where fine microstepping takes over
+#define PWM_MIN_PULSES 32 // Shortest cruise handed to a hardware pulse train
+#define PWM_MIN_PERIOD 200000 // ns, a quarter period has to cover the sysfs writes that start and stop a train
+#define PWM_POLL_INTERVAL 1000 // us between checks for stops and retargets during a train, a limit switch ends the wait at once
+#define MISSED_STEP_THRESHOLD 8 // Steps of drift found at a limit switch that raise the missed-step alarm
 
+// How calibrate() homes on each limit switch: a fast accelerated seek to
+// the switch, a short back-off and a slow re-approach. The switch position
+// is taken from the re-approach, so it does not depend on the seek speed.
+// The range, though, is counted from the steps commanded during the seek
+// toward the top switch, so the seek has to stay within the speed the
+// motor follows without losing steps; setHoming() caps it at MAX_SPEED.
+// For the same reason the seek ramps down at seekAcceleration past the
+// switch instead of stopping dead, and the back-off covers those steps:
+// the switch needs that much overtravel before the end stop.
+struct HomingOptions {
+    float seekSpeed = HOMING_SEEK_SPEED; // RPM
+    float seekAcceleration = HOMING_SEEK_ACCELERATION; // RPM/s
+    float approachSpeed = HOMING_APPROACH_SPEED; // RPM, run without ramps
+    int backoffSteps = HOMING_BACKOFF_STEPS;
+    int maxTravel = HOMING_MAX_TRAVEL; // Steps per seek
+    uint32_t timeout = HOMING_TIMEOUT; // ms, 0 for no limit
+};
+
+// How moves switch microstep modes when the driver's MS1/MS2/MS3 lines are
+// wired to the backend. Moves travel in the coarse mode and finish the last
+// approach full steps at the stepper's own microstepping, which stays the
+// unit of every step count. The profile is planned in fine steps either
+// way, so the speed is unchanged by a switch; coarse pulses just come at a
+// fraction of the rate. The driver's step sequence is unknown until a
+// calibration or rehome lines it up with one coarse pulse, so moves run in
+// fine steps until then.
+struct MicrostepOptions {
+    bool dynamic = true; // Switch modes during moves
+    int travel = MICROSTEP_TRAVEL; // Coarse microstepping, 1, 2, 4, 8 or 16
+    int approach = MICROSTEP_APPROACH; // Full steps
+};
+
+// What moves do when they run into a limit switch. The switches mark the
+// ends of the calibrated range, so a hit is a free reference: the position
+// is snapped to 0 or the full range and the difference from the counted
+// position is recorded as drift. Drift beyond alarmThreshold raises the
+// missed-step alarm, and with rehomeOnAlarm the move then backs off and
+// re-approaches the switch slowly, as rehome() does, for a precise reference.
+struct ReferenceOptions {
+    bool snapAtLimits = true; // Take the position from limit switches hit during moves
+    int alarmThreshold = MISSED_STEP_THRESHOLD; // Steps
+    bool rehomeOnAlarm = false;
+};
+
+// Position corrections taken from limit switches since the last clear
+struct ReferenceStats {
+    uint32_t references = 0; // Limit switch hits and rehomes the position was taken from
+    uint32_t alarms = 0; // References that found more drift than the threshold
+    int lastDrift = 0; // Counted minus actual position at the last reference, in steps
+    int maxDrift = 0; // Largest drift seen, as a magnitude
+    bool missedSteps = false; // The alarm is raised, until clearMissedStepAlarm()
+};
+
+// Snapshot of the motion published by the worker after every step
+struct MotionState {
+    int position; // Step count
+    int target; // Step count the current move is heading for
+    float velocity; // Steps per second, negative while closing
+    MotionPlanner::Phase phase; // Profile phase, Idle when stopped
+    uint64_t timestamp; // Backend clock time of the last update in nanoseconds
+};
+
+// Every move and calibration runs on one motion worker thread owned by the
+// stepper, fed through a bounded MotionQueue. The blocking calls wait for
+// their command to finish; the Async calls return once it is queued. The
+// worker is the only writer of position and motion state, and publishes
+// them through atomics so the getters never block the step loop.
+//
+// The Async calls without a callback return a MotionHandle instead, which
+// reports how the command ended. A moveToStepAsync() that steers a running
+// move hands its target over to that move, so cancelling it afterwards
+// does not stop the motion; use stopMovement() for that.
 class PiStepper {
 public:
+    // What openJournal() restored from the previous session
+    enum Restored {
+        RestoredNothing, // No usable calibration, calibrate() is needed
+        RestoredRange, // Range is known but the position is not, rehome() is enough
+        RestoredPosition // Clean shutdown, ready to move
+    };
+
     PiStepper(int stepPin, int dirPin, int enablePin, int stepsPerRevolution, int microstepping);
+    PiStepper(std::unique_ptr<GpioBackend> backend, int stepsPerRevolution, int microstepping);
     PiStepper();
     ~PiStepper();
 
     // Setters
     void setSpeed(float speed); // Set the speed of the stepper motor in RPM
-    void setAcceleration(float acceleration); // Set the acceleration of the stepper motor in RPM/s
+    void setAcceleration(float acceleration); // Set the acceleration of the stepper motor in RPM/s, 0 to run without ramps
+    void setJerk(float jerk); // Set the jerk limit in RPM/s^2, 0 for a trapezoidal profile
     void setMicrostepping(int microstepping); // Set the microstepping value for the stepper motor
+    void setRealtime(const RealtimeOptions &options); // Set the scheduling used by the motion worker
+    void setQueuePolicy(MotionQueue::Policy policy); // Set how new commands treat queued and running moves
+    void setHoming(const HomingOptions &options); // Set the speeds and limits used by calibrate()
+    void setMicrostepSwitching(const MicrostepOptions &options); // Set how moves switch microstep modes
+    void setReferencing(const ReferenceOptions &options); // Set what moves do when they hit a limit switch
 
     // Getters
     int getStepsPerRevolution() const; // Get the number of steps per revolution
     int getMicrostepping() const; // Get the microstepping value
     float getSpeed() const; // Get the speed of the stepper motor in RPM
     float getAcceleration() const; // Get the acceleration of the stepper motor in RPM/s
+    float getJerk() const; // Get the jerk limit in RPM/s^2
+    RealtimeOptions getRealtime() const; // Get the scheduling used by the motion worker
+    MotionQueue::Policy getQueuePolicy() const; // Get how new commands treat queued and running moves
+    HomingOptions getHoming() const; // Get the speeds and limits used by calibrate()
+    MicrostepOptions getMicrostepSwitching() const; // Get how moves switch microstep modes
+    ReferenceOptions getReferencing() const; // Get what moves do when they hit a limit switch
 
     // Stepper control
     void enable(); // Enable the stepper motor
     void disable(); // Disable the stepper motor
     void moveSteps(int steps, int direction); // Move the stepper motor a specified number of steps in a specified direction
     void moveAngle(float angle, int direction); // Move the stepper motor a specified angle in a specified direction
-    void moveStepsAsync(int steps, int direction, std::function<void()> callback); // Move steps asynchronously
+    bool moveStepsAsync(int steps, int direction, std::function<void()> callback); // Queue a move, false if the queue is full
+    bool moveAngleAsync(float angle, int direction, std::function<void()> callback); // Queue a move by angle, false if the queue is full
     void stopMovement(); // Stop the current movement
     void emergencyStop(); // Perform an emergency stop
 
+    // Stepper control with handles, see MotionHandle
+    MotionHandle moveStepsAsync(int steps, int direction);
+    MotionHandle moveAngleAsync(float angle, int direction);
+    MotionHandle moveToStepAsync(int target); // With the queue policy
+    MotionHandle moveToStepAsync(int target, MotionQueue::Policy policy);
+    MotionHandle moveToPercentOpen(float percent);
+    MotionHandle calibrateAsync();
+    MotionHandle rehomeAsync();
+
     // Homing and calibration
     void calibrate(); // Calibrate the motor using limit switches
+    void rehome(); // Re-reference on the nearer limit switch, keeping the calibrated range
+    bool calibrateAsync(std::function<void()> callback); // Queue a calibration, check isCalibrated() in the callback
+    bool rehomeAsync(std::function<void()> callback); // Queue a rehome, check isCalibrated() in the callback
+
+    // Persisted state. Open the journal before queuing any motion; from then
+    // on calibration and resting position are recorded in it, and a clean
+    // shutdown marks them as trusted for the next start.
+    Restored openJournal(const char *path);
+
+    // Publish the state to a POSIX shared memory segment that other
+    // processes read with StatusReader. Open it before queuing any motion;
+    // only the motion worker writes it, with every published motion state
+    // and when woken after another thread changes a flag or counter. It is
+    // removed when the stepper is destroyed.
+    bool openStatusSegment(const char *name);
 
     // Position tracking
     int getCurrentStepCount() const; // Get the current step count relative to the starting position
     int getFullRangeCount() const; // Get the full range count determined during calibration
     float getPercentOpen() const; // Get the current position as a percentage of the full range
     bool isMoving() const; // Check if the motor is currently moving
+    bool isCalibrated() const; // Check if the range and position are known
+    MotionState getMotionState() const; // Get a consistent snapshot of the motion
+    bool isPositionTrusted() const; // Check that no emergency stop has cast doubt on the position since the last reference
+    ReferenceStats getReferenceStats() const; // Get the drift found at limit switches
+    void clearMissedStepAlarm(); // Acknowledge the missed-step alarm, lowering it and resetting the drift statistics
+
+    // Called on the motion worker with the latest motion, at most every
+    // MOTION_NOTIFY_INTERVAL ms while moving and once when it comes to rest.
+    // Nothing is sent while idle. The listener must return quickly, so hand
+    // the state to another thread rather than acting on it in place.
+    void setMotionListener(std::function<void(const MotionState &)> listener);
+    int addMotionListener(std::function<void(const MotionState &)> listener); // Another listener next to the one set above, returns its id
+    void removeMotionListener(int id); // Remove a listener added with addMotionListener()
+
+    // Step timing
+    StepTimingSnapshot getTimingStats() const; // Get the step edge lateness histogram and overrun counts
+    void resetTimingStats(); // Clear the step timing counters
+
+    // Telemetry
+    bool startTelemetry(const char *path); // Record every step of every move to a binary file
+    void stopTelemetry(); // Flush and close the telemetry file
+    uint64_t getDroppedTelemetry() const; // Records lost because the writer fell behind
 
     // Move to specific positions
     void moveToPercentOpen(float percent, std::function<void()> callback); // Move to a specified percentage open
     void moveToFullyOpen(); // Move to the fully open position
     void moveToFullyClosed(); // Move to the fully closed position
+    bool moveToStepAsync(int target, std::function<void()> callback); // Move to an absolute step count, steering a running move
+    bool moveToStepAsync(int target, MotionQueue::Policy policy, std::function<void()> callback); // Same, with a policy for this command only
 
 private:
-    // GPIO pin assignments
-    int _stepPin;
-    int _dirPin;
-    int _enablePin;
+    std::unique_ptr<GpioBackend> _backend; // Lines and clock driving the motor
     int _stepsPerRevolution;
     int _microstepping;
     float _speed;
     float _acceleration;
-    int _currentStepCount; // Tracks the current step position relative to the starting point
-    int _fullRangeCount; // The number of steps from fully closed to fully open
-    bool _isMoving; // Flag to indicate if the motor is moving
-    bool _isCalibrated; // Flag to indicate if the motor has been calibrated
-
-
+    float _jerk;
+    std::atomic<int> _currentStepCount; // Tracks the current step position relative to the starting point
+    std::atomic<int> _fullRangeCount; // The number of steps from fully closed to fully open
+    std::atomic<bool> _isMoving; // Flag to indicate if the motor is moving
+    std::atomic<bool> _isCalibrated; // Flag to indicate if the motor has been calibrated
+    SeqLock<MotionState> _motionState; // Latest published motion snapshot
+    StepTimingStats _timingStats; // Lateness of every step edge against its deadline
+    TelemetryRecorder _telemetry; // Optional per-step record
+    RealtimeOptions _realtime; // Scheduling applied to the step thread
+    mutable std::mutex _realtimeMutex; // Guards _realtime
+    HomingOptions _homing; // Read by the worker when a calibration starts
+    mutable std::mutex _homingMutex; // Guards _homing
+    MicrostepOptions _microsteps; // Read by the worker when a move starts
+    mutable std::mutex _microstepMutex; // Guards _microsteps
+    ReferenceOptions _referencing; // Read by the worker when a move starts
+    ReferenceStats _referenceStats; // Written by the worker at each reference
+    mutable std::mutex _referenceMutex; // Guards _referencing and _referenceStats
+    int _microstepMode; // Divisor the MS lines select, 0 if they are not driven, worker only
+    int _microstepPhase; // Driver translator position in 1/MICROSTEP_MAX steps from the last alignment, worker only
+    int _microstepGrid; // Coarsest mode _microstepPhase is known against, 0 until a coarse pulse aligns it, worker only
+    StateJournal _journal; // Persisted calibration and position
+    std::atomic<bool> _positionLost; // An emergency stop cast doubt on the position since the last reference
+    StatusPublisher _status; // Optional shared memory copy of the state
+    std::atomic<uint32_t> _faults; // StatusFault bits other than FaultPositionLost
+    std::atomic<uint32_t> _commandCount; // Commands finished, for the status segment
+    std::atomic<uint32_t> _emergencyCount;
+    std::atomic<uint32_t> _referenceCount;
+    std::atomic<uint32_t> _alarmCount;
+    std::function<void(const MotionState &)> _motionListener;
+    std::map<int, std::function<void(const MotionState &)>> _addedListeners; // By addMotionListener() id
+    int _nextListenerId;
+    std::mutex _listenerMutex; // Guards _motionListener, _addedListeners and _nextListenerId
+    uint64_t _lastNotify; // Time of the last notification, worker only
 
-    // GPIO chip and line pointers
-    gpiod_chip *chip;
-    gpiod_line *step_signal;
-    gpiod_line *dir_signal;
-    gpiod_line *enable_signal;
-    gpiod_line *limit_switch_bottom;
-    gpiod_line *limit_switch_top;
+    // Motion worker
+    MotionQueue _queue;
+    std::atomic<MotionQueue::Policy> _queuePolicy;
+    std::atomic<bool> _realtimeChanged; // _realtime needs applying to the worker
+    std::atomic<uint64_t> _activeCommand; // Id of the command the worker is running
+    std::atomic<MotionCommand::Type> _activeType; // Type of the command the worker is running
+    std::atomic<int> _retargetTarget; // New target for the running move
+    std::atomic<bool> _retargetPending; // _retargetTarget is waiting to be picked up by the step loop
+    std::atomic<uint64_t> _stopBefore; // Commands with a lower id stop at their next step
+    std::atomic<uint64_t> _emergencyBefore; // Commands with a lower id that stop were stopped by emergencyStop()
+    MotionOperation *_activeOperation; // Handle state of the running command, worker only
+    std::thread _worker;
 
     // Private methods
     float stepsToAngle(int steps) const; // Convert steps to angle
-    mutable std::mutex gpioMutex; // Mutex for thread-safe GPIO access
+    float rpmToStepRate(float rpm) const; // Convert RPM (or RPM/s, RPM/s^2) to steps
+    void planMove(MotionPlanner &planner, int steps) const; // Plan a move with the current motion settings
+    uint64_t submit(const MotionCommand &command, MotionQueue::Policy policy); // Queue a command, 0 if rejected
+    uint64_t submitMoveTo(const MotionCommand &command, MotionQueue::Policy policy); // Queue or steer toward a MoveToStep
+    MotionHandle submitTracked(MotionCommand &command, MotionQueue::Policy policy); // Queue a command with a handle
+    MotionHandle rejected(); // Handle of a command refused before it was queued
+    void runAndWait(MotionCommand &command); // Queue a command and wait for it to finish
+    void runWorker(); // Motion worker thread body
+    MotionResult::Outcome execute(const MotionCommand &command); // Run a command on the worker
+    MotionResult::Outcome executeMove(int target, uint64_t id); // Step loop, follows retargets until it reaches target
+    MotionResult::Outcome executeCalibrate(uint64_t id); // Home on both limit switches and measure the range
+    MotionResult::Outcome executeRehome(uint64_t id); // Home on the nearer limit switch only
+    bool takeReference(int direction, int &position, bool trusted, int overshoot = 0); // Snap to the switch just reached and record the drift, true on an alarm
+    bool stopRequested(uint64_t id) const; // The running command has been stopped or cancelled, worker only
+    MotionResult::Outcome stopOutcome(uint64_t id) const; // Stopped or EmergencyStopped
+    bool runPulseTrain(MotionPlanner &planner, int stride, int pulses, int direction, int target, uint64_t id,
+                       uint64_t &deadline, int &position, uint32_t &stepIndex, int &overshoot); // Cruise on the backend's pulse generator
+    bool homeOnLimit(int direction, const HomingOptions &homing, uint64_t id, uint64_t timeoutAt, int &travel); // Seek, back off and re-approach one switch
+    bool homingMove(int direction, int steps, float speed, float acceleration, bool seek,
+                    uint64_t id, uint64_t timeoutAt, int &taken, int &braked); // Step toward or away from a switch, braked counts steps past it
+    bool selectMicrostepMode(int microstepping); // Drive the MS lines, false if they are not wired, worker only
+    void advanceMicrostepPhase(int direction, int steps); // Follow the translator through fine steps, worker only
+    bool microstepAligned(int microstepping) const; // The translator can step in this mode from where it is
+    bool alignMicrostepPhase(int direction); // Put the translator on the coarse grid before homing, true if the valve moved
+    void raiseStop(uint64_t before); // Stop every command with an id below before
+    static void raiseBound(std::atomic<uint64_t> &bound, uint64_t value); // Raise an id bound, never lower it
+    void runCallbacks(MotionCommand *commands, int count, MotionResult::Outcome outcome); // Complete discarded commands
+    void publishState(int position, int target, float velocity, MotionPlanner::Phase phase); // Worker only
+    void journalState(bool trusted, bool sync); // Record calibration and position, worker only
+    void publishStatus(const MotionState &state); // Copy the state to the status segment, if open, worker only
+    void requestStatus(); // Have the worker publish the status after another thread changed it
 };
 
 #endif // PiStepper_h
@@ -0,0 +1,863 @@
+/**
+ * @file PiStepperBench.cpp
+ * @brief Benchmarks for the PiStepper control path
+ *
+ * Compilation:
+ * g++ -O2 -o PiStepperBench PiStepperBench.cpp PiStepper.cpp MotionPlanner.cpp MotionQueue.cpp LibgpiodBackend.cpp SimulatedValve.cpp StepClock.cpp StepTimingStats.cpp StateJournal.cpp TelemetryRecorder.cpp PwmStepBackend.cpp MotionHandle.cpp StatusSegment.cpp CommandServer.cpp ValveBank.cpp LibgpiodBankIo.cpp SimulatedBankIo.cpp PidController.cpp FileFeedback.cpp SimulatedPlant.cpp -lgpiod -pthread -lrt
+ *
+ * Runs without hardware and prints one JSON object on stdout, so results
+ * can be saved and compared between versions. Progress goes to stderr.
+ * Exits with status 1 when a correctness check fails, such as pulse train
+ * step accounting, command server response order or a ValveBank
+ * calibration that does not give up on a jammed valve, or a closed loop
+ * that does not settle or does not time out on a stalled feedback FIFO.
+ *
+ * Options:
+ * --quick       Shorter runs, for a smoke test
+ * --rt          Run the motion worker with SCHED_FIFO priority and locked memory
+ * --readers N   Reader threads for the getPercentOpen() and status segment contention tests (default 2)
+ * --stroke N    Steps between the limit switches for the calibrate() test (default 200)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "CommandServer.h"
+#include "FileFeedback.h"
+#include "PidController.h"
+#include "PiStepper.h"
+#include "PwmStepBackend.h"
+#include "SimulatedBankIo.h"
+#include "SimulatedPlant.h"
+#include "SimulatedValve.h"
+#include "ValveBank.h"
+
+#define BENCH_STEPS_PER_REVOLUTION 200
+#define BENCH_MIN_RATE 1000 // steps/s the rate sweep starts at
+#define BENCH_MAX_RATE 1024000 // steps/s the rate sweep gives up at
+#define BENCH_RATE_TOLERANCE 0.95 // Fraction of the requested rate a trial has to reach
+#define BENCH_OVERRUN_ALLOWANCE 10 // Overruns a trial may have, so a few preemptions do not fail it at any trial size
+#define BENCH_FAILED_TRIALS 2 // Failed rates in a row that end the sweep
+#define BENCH_LATENCY_MICROSTEPPING 64 // Keeps single step moves short in the latency test
+#define BENCH_TRAIN_RATE 4000 // steps/s for the pulse train comparison
+#define BENCH_TRAIN_STROKE 4000 // Steps between the switches of the valve the pulse train cases run on
+#define BENCH_STATUS_SEGMENT "/motorized_valve_bench.status" // Kept apart from a running valve's segment
+#define BENCH_CPU_STATUS_SEGMENT "/motorized_valve_bench_cpu.status"
+#define BENCH_COMMAND_SOCKET "/tmp/motorized_valve_bench.sock" // Kept apart from a running valve's socket
+#define BENCH_UNREAD_BYTES (16 * 1024 * 1024) // Status requests a client that never reads tries to queue
+#define BENCH_STALL_MS 200 // ms without the server taking more bytes that count as held back
+#define BENCH_BANK_CHANNELS 4
+#define BENCH_BANK_STROKE 2000 // Steps between the switches of each bank valve
+#define BENCH_BANK_TIMEOUT 1000 // ms the timed out bank calibration is given
+#define BENCH_PID_SETPOINT 40 // Process variable the closed loop holds, the plant reads percent open
+#define BENCH_PID_TOLERANCE 1 // Distance from the setpoint the loop has to settle within
+#define BENCH_FEEDBACK_FIFO "/tmp/motorized_valve_bench.fifo"
+
+// GpioBackend that drives no lines and runs on the real clock. It counts
+// steps like a valve would and reports the limit switches at both ends of
+// its stroke until they are turned off, so a stepper can be calibrated on
+// it and then moved without running out of travel. A TrainValve on top
+// feeds it the pulses of its trains as well.
+class NullBackend : public GpioBackend {
+public:
+    explicit NullBackend(int stroke) :
+        _stroke(stroke),
+        _position(stroke / 2),
+        _step(0),
+        _direction(0),
+        _enable(0),
+        _limitsEnabled(true),
+        _firstEdge(0),
+        _trainEdge(0),
+        _trainPeriod(0),
+        _trainTrip(0)
+    {
+    }
+
+    bool isOpen() const override { return true; }
+
+    void setStep(int value) override {
+        int previous = _step.exchange(value);
+        if (previous != 0 || value == 0 || !_enable) {
+            return;
+        }
+        if (_firstEdge.load(std::memory_order_relaxed) == 0) {
+            _firstEdge.store(monotonicNow(), std::memory_order_relaxed);
+        }
+        _position += _direction ? 1 : -1;
+    }
+
+    void setDirection(int value) override { _direction = value; }
+    void setEnable(int value) override { _enable = value; }
+    int readLimitTop() override { return (triggeredLimits() & LimitTop) ? 0 : 1; }
+    int readLimitBottom() override { return (triggeredLimits() & LimitBottom) ? 0 : 1; }
+
+    int triggeredLimits() override {
+        if (!_limitsEnabled.load(std::memory_order_relaxed)) {
+            return 0;
+        }
+        int position = this->position();
+        return (position >= _stroke ? LimitTop : 0) | (position <= 0 ? LimitBottom : 0);
+    }
+
+    // A running train reaches a switch at a known time, wake right after its pulse like an edge event would
+    int waitForLimits(int flags, uint64_t deadline) override {
+        if (triggeredLimits() & flags) {
+            return triggeredLimits();
+        }
+        uint64_t trip = _trainTrip;
+        if (_trainPeriod && trip && _limitsEnabled.load(std::memory_order_relaxed)) {
+            deadline = std::min(deadline, trip + 1);
+        }
+        sleepUntil(deadline);
+        return triggeredLimits();
+    }
+
+    // Only switches closed by a train pulse are timed
+    uint64_t limitClosedAt(int flag) override {
+        uint64_t trip = _trainTrip;
+        return (triggeredLimits() & flag) && trip <= monotonicNow() ? trip : 0;
+    }
+
+    uint64_t now() override { return monotonicNow(); }
+    void sleepUntil(uint64_t deadline) override { sleepUntilDeadline(deadline, DEFAULT_SPIN_WINDOW); }
+
+    void setLimitsEnabled(bool enabled) { _limitsEnabled = enabled; }
+    void startTrain(uint64_t firstEdge, uint64_t period) {
+        int position = _position;
+        int pulses = _direction ? _stroke - position : position; // The pulse that closes the switch ahead
+        _trainTrip = pulses >= 1 ? firstEdge + (pulses - 1) * period : 0;
+        _trainEdge = firstEdge;
+        _trainPeriod = period;
+    }
+    void endTrain(int pulses) { _position += _direction ? pulses : -pulses; _trainPeriod = 0; }
+
+    // Net steps, including the pulses a running train has started so far
+    int position() const {
+        uint64_t period = _trainPeriod;
+        uint64_t now = monotonicNow();
+        int pulses = period && now > _trainEdge ? static_cast<int>((now - _trainEdge + period - 1) / period) : 0;
+        return _position + (_direction ? pulses : -pulses);
+    }
+    void armFirstEdge() { _firstEdge = 0; } // Record the time of the next rising edge
+    uint64_t firstEdge() const { return _firstEdge; } // Time of the edge after armFirstEdge(), 0 if none yet
+
+private:
+    int _stroke;
+    std::atomic<int> _position;
+    std::atomic<int> _step;
+    std::atomic<int> _direction;
+    std::atomic<int> _enable;
+    std::atomic<bool> _limitsEnabled;
+    std::atomic<uint64_t> _firstEdge;
+    std::atomic<uint64_t> _trainEdge; // First edge of the running train
+    std::atomic<uint64_t> _trainPeriod; // Period of the running train, 0 when none is running
+    std::atomic<uint64_t> _trainTrip; // Rising edge of the last train's pulse that reaches a switch, 0 if none does
+};
+
+// Silences PiStepper's progress messages on stdout, which would break the JSON
+class QuietCout {
+public:
+    QuietCout() : _saved(std::cout.rdbuf(nullptr)) {}
+    ~QuietCout() { std::cout.rdbuf(_saved); std::cout.clear(); }
+
+private:
+    std::streambuf *_saved;
+};
+
+uint64_t processCpuNow() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Run the stepper at a constant rate with no ramps
+void setConstantRate(PiStepper &stepper, double rate) {
+    int microstepping = static_cast<int>((rate * 60 + BENCH_STEPS_PER_REVOLUTION * MAX_SPEED - 1) /
+                                         (BENCH_STEPS_PER_REVOLUTION * MAX_SPEED));
+    microstepping = std::max(microstepping, 1);
+    stepper.setMicrostepping(microstepping);
+    stepper.setSpeed(rate * 60 / (BENCH_STEPS_PER_REVOLUTION * microstepping));
+    stepper.setAcceleration(0);
+}
+
+double percentile(std::vector<double> &values, double fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(fraction * (values.size() - 1) + 0.5);
+    return values[index];
+}
+
+// Highest constant step rate the real-time loop keeps up with: at most
+// BENCH_OVERRUN_ALLOWANCE overruns and at least BENCH_RATE_TOLERANCE of the
+// requested rate. The sweep doubles the rate until BENCH_FAILED_TRIALS
+// rates in a row fail and reports the highest one that passed.
+double benchMaxStepRate(PiStepper &stepper, bool quick, double &worstLateness) {
+    double sustained = 0;
+    worstLateness = 0;
+    int direction = 1;
+    int failed = 0;
+    for (double rate = BENCH_MIN_RATE; rate <= BENCH_MAX_RATE && failed < BENCH_FAILED_TRIALS; rate *= 2) {
+        setConstantRate(stepper, rate);
+        int steps = std::max(static_cast<int>(rate * (quick ? 0.05 : 0.25)), 200);
+        stepper.resetTimingStats();
+
+        uint64_t start = monotonicNow();
+        stepper.moveSteps(steps, direction);
+        uint64_t elapsed = monotonicNow() - start;
+        direction = 1 - direction;
+
+        StepTimingSnapshot timing = stepper.getTimingStats();
+        double achieved = steps * 1e9 / elapsed;
+        std::cerr << "  " << rate << " steps/s requested, " << achieved << " achieved, "
+                  << timing.overruns << " overruns" << std::endl;
+        if (timing.overruns > BENCH_OVERRUN_ALLOWANCE || achieved < rate * BENCH_RATE_TOLERANCE) {
+            failed++; // One slow trial can be a burst of load, try the next rate before giving up
+            continue;
+        }
+        failed = 0;
+        sustained = rate;
+        worstLateness = timing.worstLateness / 1000.0;
+    }
+    return sustained;
+}
+
+// Time from moveStepsAsync() returning control to the worker until the first step edge
+void benchFirstEdgeLatency(PiStepper &stepper, NullBackend &backend, bool quick, std::vector<double> &latencies) {
+    stepper.setMicrostepping(BENCH_LATENCY_MICROSTEPPING);
+    stepper.setSpeed(DEFAULT_SPEED);
+    stepper.setAcceleration(DEFAULT_ACCELERATION);
+
+    std::mutex mutex;
+    std::condition_variable done;
+    int iterations = quick ? 50 : 500;
+    for (int i = 0; i < iterations; i++) {
+        bool finished = false;
+        backend.armFirstEdge();
+        uint64_t start = monotonicNow();
+        stepper.moveStepsAsync(1, i % 2, [&]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            done.notify_one();
+        });
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return finished; });
+        if (backend.firstEdge()) {
+            latencies.push_back((backend.firstEdge() - start) / 1000.0);
+        }
+    }
+}
+
+// A pwm sysfs tree of plain files with one exported channel, for
+// PwmStepBackend to program without hardware
+class FakePwmSysfs {
+public:
+    FakePwmSysfs() {
+        char root[] = "/tmp/pwmbenchXXXXXX";
+        if (!mkdtemp(root)) {
+            return;
+        }
+        _root = root;
+        mkdir((_root + "/pwmchip0").c_str(), 0755);
+        mkdir((_root + "/pwmchip0/pwm0").c_str(), 0755);
+        for (const char *file : {"export", "unexport", "pwm0/period", "pwm0/duty_cycle", "pwm0/enable"}) {
+            std::ofstream(_root + "/pwmchip0/" + file) << "0\n";
+        }
+    }
+
+    ~FakePwmSysfs() {
+        if (_root.empty()) {
+            return;
+        }
+        for (const char *file : {"export", "unexport", "pwm0/period", "pwm0/duty_cycle", "pwm0/enable"}) {
+            unlink((_root + "/pwmchip0/" + file).c_str());
+        }
+        rmdir((_root + "/pwmchip0/pwm0").c_str());
+        rmdir((_root + "/pwmchip0").c_str());
+        rmdir(_root.c_str());
+    }
+
+    const char *root() const { return _root.c_str(); }
+
+    long read(const char *attribute) const {
+        std::ifstream file(_root + "/pwmchip0/pwm0/" + attribute);
+        long value = -1;
+        file >> value;
+        return value;
+    }
+
+private:
+    std::string _root;
+};
+
+// PwmStepBackend on a fake sysfs tree whose channel drives the
+// NullBackend under it: the valve counts the pulses of a running train
+// from its start time, so trains can run into the limit switches
+class TrainValve : public PwmStepBackend {
+public:
+    TrainValve(NullBackend *valve, const char *root) :
+        PwmStepBackend(std::unique_ptr<GpioBackend>(valve), root, 0, 0),
+        _valve(valve)
+    {
+    }
+
+    bool startPulses(uint64_t period, uint64_t &firstEdge) override {
+        if (!PwmStepBackend::startPulses(period, firstEdge)) {
+            return false;
+        }
+        _valve->startTrain(firstEdge, period);
+        return true;
+    }
+
+    int stopPulses() override {
+        int pulses = PwmStepBackend::stopPulses();
+        _valve->endTrain(pulses);
+        return pulses;
+    }
+
+private:
+    NullBackend *_valve;
+};
+
+struct PulseTrainResults {
+    double bitbangCpu; // CPU ns per step with the cruise bit-banged
+    double trainCpu; // CPU ns per step with the cruise on the PWM channel
+    double hardwareFraction; // Steps of the long move sent by the PWM channel
+    bool accounted; // The long move ended on its count and with the channel off
+    bool stopAccounted; // A stop mid-train left count and valve together
+    bool retargetAccounted; // A retarget behind the valve mid-train ended on the new target
+    bool limitAccounted; // A train into a switch was cut at once and referenced without drift
+    int limitOvershoot; // Steps the valve went past the switch
+    uint64_t writeLatency; // ns taken by the longest PWM attribute write
+};
+
+// CPU time per step of one long move, bit-banged and with the cruise on
+// a PWM channel, then trains that run into a limit switch, are turned
+// back and are stopped. The valve counts every pulse, so its position has
+// to match the stepper's count after each of them.
+void benchPulseTrain(bool quick, PulseTrainResults &results) {
+    FakePwmSysfs sysfs;
+    NullBackend *null = new NullBackend(BENCH_TRAIN_STROKE);
+    TrainValve *pwm = new TrainValve(null, sysfs.root());
+    PiStepper stepper(std::unique_ptr<GpioBackend>(pwm), BENCH_STEPS_PER_REVOLUTION, 1);
+    setConstantRate(stepper, BENCH_TRAIN_RATE); // Before calibrating, so the stroke is homed in these microsteps
+    stepper.calibrate();
+
+    // Down from the top switch past the bottom one
+    MotionResult hit = stepper.moveStepsAsync(2 * BENCH_TRAIN_STROKE, 0).wait();
+    ReferenceStats references = stepper.getReferenceStats();
+    results.limitOvershoot = -null->position();
+    results.limitAccounted = hit.outcome == MotionResult::LimitHit && pwm->getPulseCount() > 0 &&
+                             stepper.getCurrentStepCount() == null->position() && references.references == 1 &&
+                             references.lastDrift == 0 && results.limitOvershoot <= 1 && sysfs.read("enable") == 0;
+
+    // Turned back a third of the way up, to a target behind the valve
+    stepper.setAcceleration(4 * stepper.getSpeed()); // Quarter second ramps
+    std::chrono::milliseconds third(1000 * BENCH_TRAIN_STROKE / (3 * BENCH_TRAIN_RATE));
+    MotionHandle move = stepper.moveToStepAsync(BENCH_TRAIN_STROKE);
+    std::this_thread::sleep_for(third);
+    int target = BENCH_TRAIN_STROKE / 8;
+    stepper.moveToStepAsync(target).wait();
+    MotionResult turned = move.wait();
+    results.retargetAccounted = turned.outcome == MotionResult::Redirected && stepper.getCurrentStepCount() == target &&
+                                null->position() == target && sysfs.read("enable") == 0;
+
+    // Stopped a third of the way, past the switches
+    null->setLimitsEnabled(false);
+    int countStart = stepper.getCurrentStepCount();
+    move = stepper.moveStepsAsync(BENCH_TRAIN_STROKE, 1);
+    std::this_thread::sleep_for(third);
+    stepper.stopMovement();
+    MotionResult stopped = move.wait();
+    int travelled = stepper.getCurrentStepCount() - countStart;
+    results.stopAccounted = stopped.outcome == MotionResult::Stopped && travelled > 0 && travelled < BENCH_TRAIN_STROKE &&
+                            stepper.getCurrentStepCount() == null->position() && sysfs.read("enable") == 0;
+
+    // Bit-banged: a backend without a pulse generator
+    int steps = quick ? BENCH_TRAIN_RATE : 5 * BENCH_TRAIN_RATE;
+    NullBackend *plain = new NullBackend(200);
+    PiStepper reference(std::unique_ptr<GpioBackend>(plain), BENCH_STEPS_PER_REVOLUTION, 1);
+    reference.calibrate();
+    plain->setLimitsEnabled(false);
+    setConstantRate(reference, BENCH_TRAIN_RATE);
+    reference.setAcceleration(4 * reference.getSpeed());
+    uint64_t cpuStart = processCpuNow();
+    reference.moveSteps(steps, 1);
+    results.bitbangCpu = static_cast<double>(processCpuNow() - cpuStart) / steps;
+
+    int valveStart = null->position();
+    uint64_t pulseStart = pwm->getPulseCount();
+    countStart = stepper.getCurrentStepCount();
+    cpuStart = processCpuNow();
+    stepper.moveSteps(steps, 1);
+    results.trainCpu = static_cast<double>(processCpuNow() - cpuStart) / steps;
+
+    long hardware = static_cast<long>(pwm->getPulseCount() - pulseStart);
+    results.hardwareFraction = static_cast<double>(hardware) / steps;
+    results.accounted = null->position() - valveStart == steps && stepper.getCurrentStepCount() - countStart == steps &&
+                        hardware > 0 && sysfs.read("enable") == 0 && sysfs.read("period") > 0;
+    results.writeLatency = pwm->getWriteLatency();
+}
+
+// Nanoseconds per getPercentOpen() call on each reader thread
+double benchPercentOpen(PiStepper &stepper, int readers, bool quick) {
+    std::atomic<bool> run(true);
+    std::atomic<long> calls(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; i++) {
+        threads.emplace_back([&]() {
+            long count = 0;
+            volatile float sink = 0;
+            while (run.load(std::memory_order_relaxed)) {
+                sink = stepper.getPercentOpen();
+                count++;
+            }
+            (void)sink;
+            calls += count;
+        });
+    }
+    uint64_t start = monotonicNow();
+    std::this_thread::sleep_for(std::chrono::milliseconds(quick ? 100 : 1000));
+    run = false;
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    uint64_t elapsed = monotonicNow() - start;
+    return calls ? static_cast<double>(elapsed) * readers / calls : 0;
+}
+
+// Nanoseconds per StatusReader::read() on each reader thread, each with its own mapping like a separate process
+double benchStatusRead(int readers, bool quick) {
+    std::atomic<bool> run(true);
+    std::atomic<long> calls(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; i++) {
+        threads.emplace_back([&]() {
+            StatusReader reader;
+            if (!reader.open(BENCH_STATUS_SEGMENT)) {
+                return;
+            }
+            long count = 0;
+            ValveStatus status;
+            while (run.load(std::memory_order_relaxed)) {
+                count += reader.read(status);
+            }
+            calls += count;
+        });
+    }
+    uint64_t start = monotonicNow();
+    std::this_thread::sleep_for(std::chrono::milliseconds(quick ? 100 : 1000));
+    run = false;
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    uint64_t elapsed = monotonicNow() - start;
+    return calls ? static_cast<double>(elapsed) * readers / calls : 0;
+}
+
+struct CommandServerResults {
+    double requestsPerSecond; // Pipelined mixed requests answered
+    bool ordered; // One response per request, each matching its request
+    long unreadAccepted; // Bytes of requests the server took from a client that did not read
+    bool unreadAnswered; // That client got every response once it read them
+};
+
+// Connected client socket, -1 on failure
+int connectCommandSocket() {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, BENCH_COMMAND_SOCKET);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Read up to count lines, false on a timeout or a closed socket
+bool readLines(int fd, size_t count, std::vector<std::string> &lines, int timeoutMs) {
+    std::string pending;
+    char buffer[65536];
+    while (lines.size() < count) {
+        pollfd readable = {fd, POLLIN, 0};
+        if (poll(&readable, 1, timeoutMs) <= 0) {
+            return false;
+        }
+        ssize_t received = read(fd, buffer, sizeof(buffer));
+        if (received <= 0) {
+            return false;
+        }
+        pending.append(buffer, received);
+        size_t start = 0;
+        size_t end;
+        while ((end = pending.find('\n', start)) != std::string::npos) {
+            lines.push_back(pending.substr(start, end - start));
+            start = end + 1;
+        }
+        pending.erase(0, start);
+    }
+    return true;
+}
+
+// CommandServer on a simulated valve. One client pipelines a mix of
+// requests from a writer thread while reading the responses, which have to
+// come back one per request and in order. Another writes status requests
+// without reading: the server has to stop taking them once its backlog for
+// that client is full, and still answer each one when the client reads.
+void benchCommandServer(bool quick, CommandServerResults &results) {
+    PiStepper stepper(std::unique_ptr<GpioBackend>(new SimulatedValve(0, 2000, 1000)), BENCH_STEPS_PER_REVOLUTION, 1);
+    stepper.calibrate();
+    CommandServer server(stepper);
+    results = CommandServerResults();
+    if (!server.start(BENCH_COMMAND_SOCKET)) {
+        return;
+    }
+
+    // Every kind of answer: status lines, ok or error from moves, and an
+    // unknown command echoing its sequence number
+    int requests = quick ? 5000 : 50000;
+    std::string script;
+    for (int i = 0; i < requests; i++) {
+        switch (i % 6) {
+            case 0: script += "status\n"; break;
+            case 1: script += "step 10\n"; break;
+            case 2: script += "move " + std::to_string(i % 100) + "\n"; break;
+            case 3: script += "mark" + std::to_string(i) + "\n"; break;
+            case 4: script += "stop\n"; break;
+            case 5: script += "step -10\n"; break;
+        }
+    }
+    int fd = connectCommandSocket();
+    std::vector<std::string> lines;
+    uint64_t start = monotonicNow();
+    std::thread writer([&]() {
+        for (size_t sent = 0; fd >= 0 && sent < script.size();) {
+            ssize_t written = send(fd, script.data() + sent, script.size() - sent, MSG_NOSIGNAL);
+            if (written <= 0) {
+                return;
+            }
+            sent += written;
+        }
+    });
+    bool complete = fd >= 0 && readLines(fd, requests, lines, 5000);
+    results.requestsPerSecond = requests * 1e9 / (monotonicNow() - start);
+    writer.join();
+    results.ordered = complete && lines.size() == static_cast<size_t>(requests);
+    for (int i = 0; results.ordered && i < requests; i++) {
+        const std::string &line = lines[i];
+        switch (i % 6) {
+            case 0: results.ordered = line.compare(0, 7, "status ") == 0; break;
+            case 3: results.ordered = line == "error unknown command mark" + std::to_string(i); break;
+            case 4: results.ordered = line == "ok"; break;
+            default: results.ordered = line == "ok" || (line.compare(0, 6, "error ") == 0 && line.compare(0, 21, "error unknown command") != 0); break;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    // Write until the server has taken nothing for BENCH_STALL_MS
+    fd = connectCommandSocket();
+    if (fd < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    std::string request = "status\n";
+    long accepted = 0;
+    uint64_t lastProgress = monotonicNow();
+    while (accepted < BENCH_UNREAD_BYTES && monotonicNow() - lastProgress < BENCH_STALL_MS * 1000000ULL) {
+        ssize_t written = send(fd, request.data() + accepted % request.size(), request.size() - accepted % request.size(), MSG_NOSIGNAL);
+        if (written > 0) {
+            accepted += written;
+            lastProgress = monotonicNow();
+        } else if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            break;
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    results.unreadAccepted = accepted;
+
+    // Only whole lines are requests
+    lines.clear();
+    size_t expected = accepted / request.size();
+    results.unreadAnswered = readLines(fd, expected, lines, 5000) && lines.size() == expected;
+    for (const std::string &line : lines) {
+        results.unreadAnswered = results.unreadAnswered && line.compare(0, 7, "status ") == 0;
+    }
+    close(fd);
+}
+
+struct ValveBankResults {
+    double calibrateMs; // calibrate() over every channel of a healthy bank
+    bool calibrated; // Every channel of that bank found both switches
+    bool travelStopped; // A jammed channel gave up after the maximum travel, the others calibrated
+    bool timeoutStopped; // A jammed channel gave up at the timeout
+};
+
+// ValveBank calibration on simulated valves: a healthy bank, then one with
+// a jammed valve whose pulses never move it, so its switches never close.
+// The sweep has to give up on that channel, once after the maximum travel
+// and once at the timeout, and leave the rest of the bank usable.
+void benchValveBank(ValveBankResults &results) {
+    SimulatedBankIo *io = new SimulatedBankIo(BENCH_BANK_CHANNELS, 0, BENCH_BANK_STROKE, BENCH_BANK_STROKE / 2);
+    ValveBank bank(std::unique_ptr<BankIo>(io), BENCH_STEPS_PER_REVOLUTION, 1);
+    uint64_t start = monotonicNow();
+    results.calibrated = bank.calibrate();
+    results.calibrateMs = (monotonicNow() - start) / 1e6;
+    for (int i = 0; i < BENCH_BANK_CHANNELS; i++) {
+        results.calibrated = results.calibrated && bank.getFullRangeCount(i) == BENCH_BANK_STROKE;
+    }
+
+    io = new SimulatedBankIo(2, 0, BENCH_BANK_STROKE, BENCH_BANK_STROKE / 2);
+    io->valve(1).setStallRate(1);
+    ValveBank jammed(std::unique_ptr<BankIo>(io), BENCH_STEPS_PER_REVOLUTION, 1);
+    BankHomingOptions homing;
+    homing.timeout = 0;
+    jammed.setHoming(homing);
+    results.travelStopped = !jammed.calibrate() && jammed.isCalibrated(0) && !jammed.isCalibrated(1) &&
+                            !jammed.isMoving(1) && io->valve(1).getStepCount() == homing.maxTravel &&
+                            jammed.moveTo(0, BENCH_BANK_STROKE / 4);
+    jammed.waitIdle();
+    results.travelStopped = results.travelStopped && jammed.getCurrentStepCount(0) == BENCH_BANK_STROKE / 4;
+
+    homing.maxTravel = 1000000000;
+    homing.timeout = BENCH_BANK_TIMEOUT;
+    jammed.setHoming(homing);
+    uint64_t clockStart = io->now();
+    results.timeoutStopped = !jammed.calibrate() && !jammed.isCalibrated(1) && !jammed.isMoving(1) &&
+                             io->now() - clockStart >= BENCH_BANK_TIMEOUT * 1000000ULL &&
+                             io->now() - clockStart < 2 * BENCH_BANK_TIMEOUT * 1000000ULL;
+}
+
+struct ClosedLoopResults {
+    bool settled; // The loop held SimulatedPlant at the setpoint
+    double settledError; // Distance from the setpoint at the end of the run
+    bool feedbackTimeout; // The loop stopped after its FIFO writer went quiet
+    double timeoutMs; // Time from the last FIFO line to the loop stopping
+};
+
+// PidController against SimulatedPlant on a simulated valve, then against
+// a FIFO whose writer stops: the loop has to give up PID_FEEDBACK_TIMEOUT
+// after the last line instead of steering from the stale value.
+void benchClosedLoop(bool quick, ClosedLoopResults &results) {
+    PiStepper stepper(std::unique_ptr<GpioBackend>(new SimulatedValve(0, 2000, 0)), BENCH_STEPS_PER_REVOLUTION, 1);
+    stepper.calibrate();
+
+    {
+        SimulatedPlant plant(stepper, 1, 0, 0.2f);
+        PidController controller(stepper, plant);
+        PidOptions options;
+        options.kp = 0.5f; // Tuned for the fast unit-gain plant, the defaults settle too slowly for a short run
+        options.ki = 4;
+        controller.setOptions(options);
+        controller.setSetpoint(BENCH_PID_SETPOINT);
+        controller.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(quick ? 3000 : 6000));
+        results.settledError = std::abs(controller.getMeasurement() - BENCH_PID_SETPOINT);
+        results.settled = controller.isRunning() && results.settledError <= BENCH_PID_TOLERANCE;
+        controller.stop();
+    }
+
+    unlink(BENCH_FEEDBACK_FIFO);
+    results.feedbackTimeout = false;
+    results.timeoutMs = 0;
+    if (mkfifo(BENCH_FEEDBACK_FIFO, 0600) != 0) {
+        std::cerr << "Failed to create " << BENCH_FEEDBACK_FIFO << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+    int writer = open(BENCH_FEEDBACK_FIFO, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    FileFeedback feedback(BENCH_FEEDBACK_FIFO);
+    PidController controller(stepper, feedback);
+    controller.setSetpoint(BENCH_PID_SETPOINT);
+    controller.start();
+    uint64_t lastLine = monotonicNow();
+    for (int i = 0; i < 10; i++) {
+        std::string line = std::to_string(BENCH_PID_SETPOINT - 5) + "\n";
+        if (write(writer, line.data(), line.size()) == static_cast<ssize_t>(line.size())) {
+            lastLine = monotonicNow();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(PID_SAMPLE_INTERVAL / 2));
+    }
+
+    // The writer stays open but goes quiet, like a sensor reader that hung
+    while (controller.isRunning() && monotonicNow() - lastLine < 2 * PID_FEEDBACK_TIMEOUT * 1000000ULL) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    results.timeoutMs = (monotonicNow() - lastLine) / 1e6;
+    results.feedbackTimeout = !controller.isRunning() && results.timeoutMs >= PID_FEEDBACK_TIMEOUT;
+    controller.stop();
+    close(writer);
+    unlink(BENCH_FEEDBACK_FIFO);
+}
+
+int main(int argc, char *argv[]) {
+    bool quick = false;
+    int readers = 2;
+    int stroke = 200;
+    RealtimeOptions realtime;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else if (std::strcmp(argv[i], "--rt") == 0) {
+            realtime.enabled = true;
+        } else if (std::strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            readers = std::max(std::atoi(argv[++i]), 1);
+        } else if (std::strcmp(argv[i], "--stroke") == 0 && i + 1 < argc) {
+            stroke = std::max(std::atoi(argv[++i]), 2);
+        } else {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    double calibrateMs, maxStepRate, worstLateness, cpuPerStep, cpuPerStepStatus, idleReadNs, busyReadNs, statusReadNs;
+    PulseTrainResults train;
+    CommandServerResults commands;
+    ValveBankResults bank;
+    ClosedLoopResults closedLoop;
+    std::vector<double> latencies;
+    {
+        QuietCout quiet;
+
+        // Real clock, no lines: calibration time, step rate, latency and contention
+        NullBackend *null = new NullBackend(stroke);
+        PiStepper stepper(std::unique_ptr<GpioBackend>(null), BENCH_STEPS_PER_REVOLUTION, 1);
+        stepper.setRealtime(realtime);
+        stepper.openStatusSegment(BENCH_STATUS_SEGMENT);
+
+        std::cerr << "calibrate() over " << stroke << " steps" << std::endl;
+        uint64_t start = monotonicNow();
+        stepper.calibrate();
+        calibrateMs = (monotonicNow() - start) / 1e6;
+        null->setLimitsEnabled(false);
+
+        std::cerr << "Maximum step rate" << std::endl;
+        maxStepRate = benchMaxStepRate(stepper, quick, worstLateness);
+
+        std::cerr << "First edge latency" << std::endl;
+        benchFirstEdgeLatency(stepper, *null, quick, latencies);
+
+        std::cerr << "getPercentOpen() with " << readers << " readers" << std::endl;
+        idleReadNs = benchPercentOpen(stepper, readers, quick);
+        setConstantRate(stepper, std::min(std::max(maxStepRate / 2, 1.0 * BENCH_MIN_RATE), 20000.0));
+        stepper.moveStepsAsync(1000000000, 1, nullptr);
+        busyReadNs = benchPercentOpen(stepper, readers, quick);
+        std::cerr << "Status segment with " << readers << " readers" << std::endl;
+        statusReadNs = benchStatusRead(readers, quick);
+        stepper.stopMovement();
+
+        // Virtual clock: the loop never waits, so CPU time is all control overhead
+        std::cerr << "CPU per step" << std::endl;
+        PiStepper simulated(std::unique_ptr<GpioBackend>(new SimulatedValve(0, 2000, 1000)), BENCH_STEPS_PER_REVOLUTION, 1);
+        simulated.calibrate();
+        int moves = quick ? 10 : 100;
+        uint64_t cpuStart = processCpuNow();
+        for (int i = 0; i < moves; i++) {
+            simulated.moveSteps(1900, i % 2);
+        }
+        cpuPerStep = static_cast<double>(processCpuNow() - cpuStart) / (moves * 1900.0);
+
+        // Same again, publishing every step to a status segment
+        PiStepper published(std::unique_ptr<GpioBackend>(new SimulatedValve(0, 2000, 1000)), BENCH_STEPS_PER_REVOLUTION, 1);
+        published.openStatusSegment(BENCH_CPU_STATUS_SEGMENT);
+        published.calibrate();
+        cpuStart = processCpuNow();
+        for (int i = 0; i < moves; i++) {
+            published.moveSteps(1900, i % 2);
+        }
+        cpuPerStepStatus = static_cast<double>(processCpuNow() - cpuStart) / (moves * 1900.0);
+
+        std::cerr << "Pulse train cruise at " << BENCH_TRAIN_RATE << " steps/s" << std::endl;
+        benchPulseTrain(quick, train);
+
+        std::cerr << "Command server with pipelined requests" << std::endl;
+        benchCommandServer(quick, commands);
+
+        std::cerr << "ValveBank calibration with a jammed valve" << std::endl;
+        benchValveBank(bank);
+
+        std::cerr << "Closed loop on a simulated plant and a stalled FIFO" << std::endl;
+        benchClosedLoop(quick, closedLoop);
+    }
+
+    std::cout << "{" << std::endl;
+    std::cout << "  \"calibrate_ms\": " << calibrateMs << "," << std::endl;
+    std::cout << "  \"calibrate_stroke_steps\": " << stroke << "," << std::endl;
+    std::cout << "  \"max_step_rate\": " << maxStepRate << "," << std::endl;
+    std::cout << "  \"max_step_rate_worst_lateness_us\": " << worstLateness << "," << std::endl;
+    std::cout << "  \"cpu_ns_per_step\": " << cpuPerStep << "," << std::endl;
+    std::cout << "  \"cpu_ns_per_step_status_segment\": " << cpuPerStepStatus << "," << std::endl;
+    std::cout << "  \"first_edge_latency_samples\": " << latencies.size() << "," << std::endl;
+    std::cout << "  \"first_edge_latency_us_min\": " << percentile(latencies, 0) << "," << std::endl;
+    std::cout << "  \"first_edge_latency_us_p50\": " << percentile(latencies, 0.5) << "," << std::endl;
+    std::cout << "  \"first_edge_latency_us_p99\": " << percentile(latencies, 0.99) << "," << std::endl;
+    std::cout << "  \"first_edge_latency_us_max\": " << percentile(latencies, 1) << "," << std::endl;
+    std::cout << "  \"percent_open_readers\": " << readers << "," << std::endl;
+    std::cout << "  \"percent_open_ns_idle\": " << idleReadNs << "," << std::endl;
+    std::cout << "  \"percent_open_ns_moving\": " << busyReadNs << "," << std::endl;
+    std::cout << "  \"status_read_ns_moving\": " << statusReadNs << "," << std::endl;
+    std::cout << "  \"train_cpu_ns_per_step_bitbang\": " << train.bitbangCpu << "," << std::endl;
+    std::cout << "  \"train_cpu_ns_per_step_pwm\": " << train.trainCpu << "," << std::endl;
+    std::cout << "  \"train_hardware_fraction\": " << train.hardwareFraction << "," << std::endl;
+    std::cout << "  \"train_steps_accounted\": " << (train.accounted ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"train_stop_accounted\": " << (train.stopAccounted ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"train_retarget_accounted\": " << (train.retargetAccounted ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"train_limit_accounted\": " << (train.limitAccounted ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"train_limit_overshoot_steps\": " << train.limitOvershoot << "," << std::endl;
+    std::cout << "  \"train_write_latency_ns\": " << train.writeLatency << "," << std::endl;
+    std::cout << "  \"command_requests_per_second\": " << commands.requestsPerSecond << "," << std::endl;
+    std::cout << "  \"command_responses_ordered\": " << (commands.ordered ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"command_unread_accepted_bytes\": " << commands.unreadAccepted << "," << std::endl;
+    std::cout << "  \"command_unread_answered\": " << (commands.unreadAnswered ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"bank_calibrate_ms\": " << bank.calibrateMs << "," << std::endl;
+    std::cout << "  \"bank_calibrated\": " << (bank.calibrated ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"bank_homing_travel_stopped\": " << (bank.travelStopped ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"bank_homing_timeout_stopped\": " << (bank.timeoutStopped ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"pid_settled\": " << (closedLoop.settled ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"pid_settled_error\": " << closedLoop.settledError << "," << std::endl;
+    std::cout << "  \"pid_feedback_timeout\": " << (closedLoop.feedbackTimeout ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"pid_feedback_timeout_ms\": " << closedLoop.timeoutMs << std::endl;
+    std::cout << "}" << std::endl;
+
+    // The timings are for comparing runs, the checks have to hold on every run
+    bool passed = true;
+    if (!train.accounted || !train.stopAccounted || !train.retargetAccounted || !train.limitAccounted) {
+        std::cerr << "Pulse train step accounting failed" << std::endl;
+        passed = false;
+    }
+    if (!commands.ordered || !commands.unreadAnswered || commands.unreadAccepted >= BENCH_UNREAD_BYTES) {
+        std::cerr << "Command server responses failed" << std::endl;
+        passed = false;
+    }
+    if (!bank.calibrated || !bank.travelStopped || !bank.timeoutStopped) {
+        std::cerr << "ValveBank calibration failed" << std::endl;
+        passed = false;
+    }
+    if (!closedLoop.settled || !closedLoop.feedbackTimeout) {
+        std::cerr << "Closed-loop control failed" << std::endl;
+        passed = false;
+    }
+    return passed ? 0 : 1;
+}
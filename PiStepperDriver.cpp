@@ -3,30 +3,128 @@
  * @brief Driver code to test the PiStepper class
  * 
  * Compilation:
- * g++ -o PiStepperDriver PiStepperDriver.cpp PiStepper.cpp -lgpiod -pthread
+ * g++ -o PiStepperDriver PiStepperDriver.cpp PiStepper.cpp MotionPlanner.cpp MotionQueue.cpp LibgpiodBackend.cpp SimulatedValve.cpp StepClock.cpp StepTimingStats.cpp StateJournal.cpp TelemetryRecorder.cpp CommandServer.cpp TrajectoryPlayer.cpp PidController.cpp FileFeedback.cpp SimulatedPlant.cpp PwmStepBackend.cpp MotionHandle.cpp StatusSegment.cpp -lgpiod -pthread -lrt
+ *
+ * Run with --sim to drive a simulated valve instead of the GPIO lines and
+ * publish its status on STATUS_SEGMENT_SIM_NAME, and
+ * with --rt to run asynchronous moves with SCHED_FIFO priority and locked memory.
+ * Pass --telemetry <file> to record every step to a binary file, which
+ * TelemetryDecode converts to CSV.
+ * Pass --socket to also accept commands on COMMAND_SOCKET_PATH, see
+ * CommandServer.h for the protocol and ValveClient for a client.
+ * Pass --microstep <n> to drive the MS1/MS2/MS3 lines: moves travel in full
+ * steps and finish at 1/n steps, and every step count is in 1/n steps.
+ * Pass --pwm <chip>:<channel> to run the cruise of long moves on a hardware
+ * PWM channel whose output is ORed into the step line.
+ * On hardware the calibration and position are kept in STATE_JOURNAL_PATH, so
+ * a clean exit lets the next run start without calibrating.
+ * The state is published in the shared memory segment STATUS_SEGMENT_NAME
+ * for ValveMonitor and other local readers.
  */
 
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 #include "PiStepper.h"
+#include "LibgpiodBackend.h"
+#include "SimulatedValve.h"
+#include "PwmStepBackend.h"
+#include "CommandServer.h"
+#include "TrajectoryPlayer.h"
+#include "PidController.h"
+#include "FileFeedback.h"
+#include "SimulatedPlant.h"
 
 // Function prototypes
 void displayMenu();
 void handleMoveSteps(PiStepper& stepper);
 void handleMoveAngle(PiStepper& stepper);
 void handleCalibrate(PiStepper& stepper);
+void handleRehome(PiStepper& stepper);
 void handleMoveToPercentOpen(PiStepper& stepper);
 void handleMoveToFullyOpen(PiStepper& stepper);
 void handleMoveToFullyClosed(PiStepper& stepper);
 void handleEmergencyStop(PiStepper& stepper);
 void handleGetStatus(PiStepper& stepper);
+void handlePlayTrajectory(TrajectoryPlayer& player);
+void handleClosedLoop(PiStepper& stepper, std::unique_ptr<FeedbackSource>& feedback,
+                      std::unique_ptr<PidController>& controller);
 
-int main() {
+int main(int argc, char *argv[]) {
     int stepPin = 27;
     int dirPin = 17;
     int enablePin = 22;
-    PiStepper stepper(stepPin, dirPin, enablePin, 200, 1); // Microstepping set to 1
+    bool simulate = false;
+    const char *telemetryPath = nullptr;
+    bool serve = false;
+    int microstepping = 1;
+    int pwmChip = -1;
+    int pwmChannel = 0;
+    RealtimeOptions realtime;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--sim") == 0) {
+            simulate = true;
+        } else if (std::strcmp(argv[i], "--rt") == 0) {
+            realtime.enabled = true;
+        } else if (std::strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+            telemetryPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--socket") == 0) {
+            serve = true;
+        } else if (std::strcmp(argv[i], "--microstep") == 0 && i + 1 < argc) {
+            microstepping = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--pwm") == 0 && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%d:%d", &pwmChip, &pwmChannel) < 1) {
+                pwmChip = -1;
+            }
+        }
+    }
+
+    std::unique_ptr<GpioBackend> backend;
+    if (simulate) {
+        SimulatedValve *valve = new SimulatedValve(0, 2000 * microstepping, 1000 * microstepping); // 2000 full step stroke, starting half open
+        if (microstepping > 1) {
+            valve->setMicrostepResolution(microstepping);
+        }
+        backend.reset(valve);
+    } else if (microstepping > 1) {
+        // The MS lines are only claimed when asked for, they may be strapped on the board
+        backend.reset(new LibgpiodBackend(GPIO_CHIP_PATH, stepPin, dirPin, enablePin,
+                                          LIMIT_SWITCH_TOP_PIN, LIMIT_SWITCH_BOTTOM_PIN, MS1_PIN, MS2_PIN, MS3_PIN));
+    } else {
+        backend.reset(new LibgpiodBackend(GPIO_CHIP_PATH, stepPin, dirPin, enablePin,
+                                          LIMIT_SWITCH_TOP_PIN, LIMIT_SWITCH_BOTTOM_PIN));
+    }
+    if (!simulate && pwmChip >= 0) {
+        backend.reset(new PwmStepBackend(std::move(backend), PWM_SYSFS_ROOT, pwmChip, pwmChannel));
+    }
+    PiStepper stepper(std::move(backend), 200, microstepping);
+    stepper.setRealtime(realtime);
+    if (telemetryPath) {
+        stepper.startTelemetry(telemetryPath);
+    }
+    stepper.openStatusSegment(simulate ? STATUS_SEGMENT_SIM_NAME : STATUS_SEGMENT_NAME);
+    if (!simulate) {
+        PiStepper::Restored restored = stepper.openJournal(STATE_JOURNAL_PATH);
+        if (restored == PiStepper::RestoredPosition) {
+            std::cout << "Restored calibration and position from the last run." << std::endl;
+        } else if (restored == PiStepper::RestoredRange) {
+            std::cout << "Restored calibration, re-referencing the position." << std::endl;
+            stepper.rehome();
+        }
+    }
+
+    CommandServer server(stepper);
+    if (serve) {
+        server.start(COMMAND_SOCKET_PATH);
+    }
+
+    TrajectoryPlayer player(stepper);
+    std::unique_ptr<FeedbackSource> feedback;
+    std::unique_ptr<PidController> controller; // Declared after feedback so it stops first
 
     char choice;
     do {
@@ -54,10 +152,23 @@ int main() {
                 break;
             case '7':
                 handleEmergencyStop(stepper);
+                player.stop();
+                if (controller) {
+                    controller->stop();
+                }
                 break;
             case '8':
                 handleGetStatus(stepper);
                 break;
+            case '9':
+                handlePlayTrajectory(player);
+                break;
+            case 'r':
+                handleRehome(stepper);
+                break;
+            case 'c':
+                handleClosedLoop(stepper, feedback, controller);
+                break;
             case 'q':
                 std::cout << "Quitting..." << std::endl;
                 break;
@@ -79,6 +190,9 @@ void displayMenu() {
     std::cout << "6. Move to Fully Closed\n";
     std::cout << "7. Emergency Stop\n";
     std::cout << "8. Get Status\n";
+    std::cout << "9. Play Trajectory\n";
+    std::cout << "r. Rehome\n";
+    std::cout << "c. Closed-Loop Control\n";
     std::cout << "q. Quit\n";
     std::cout << "Enter your choice: ";
 }
@@ -89,8 +203,9 @@ void handleMoveSteps(PiStepper& stepper) {
     std::cin >> steps;
     std::cout << "Enter direction (0 for closing, 1 for opening): ";
     std::cin >> direction;
-    stepper.moveStepsAsync(steps, direction, []() {
-        std::cout << "Move Steps operation completed." << std::endl;
+    stepper.moveStepsAsync(steps, direction).then([](const MotionResult &result) {
+        std::cout << "Move Steps operation " << motionOutcomeName(result.outcome)
+                  << " at step " << result.position << "." << std::endl;
     });
 }
 
@@ -101,20 +216,32 @@ void handleMoveAngle(PiStepper& stepper) {
     std::cin >> angle;
     std::cout << "Enter direction (0 for closing, 1 for opening): ";
     std::cin >> direction;
-    stepper.moveAngle(angle, direction);
-    std::cout << "Move Angle operation completed." << std::endl;
+    stepper.moveAngleAsync(angle, direction).then([](const MotionResult &result) {
+        std::cout << "Move Angle operation " << motionOutcomeName(result.outcome)
+                  << " at step " << result.position << "." << std::endl;
+    });
 }
 
 void handleCalibrate(PiStepper& stepper) {
-    stepper.calibrate();
+    // Runs in the background so the menu, and the emergency stop, stay available
+    stepper.calibrateAsync(nullptr);
+}
+
+void handleRehome(PiStepper& stepper) {
+    // Finds the nearer limit switch only, much quicker than a calibration
+    stepper.rehomeAsync().then([](const MotionResult &result) {
+        std::cout << "Rehome operation " << motionOutcomeName(result.outcome)
+                  << " at step " << result.position << "." << std::endl;
+    });
 }
 
 void handleMoveToPercentOpen(PiStepper& stepper) {
     float percent;
     std::cout << "Enter percent open (0-100): ";
     std::cin >> percent;
-    stepper.moveToPercentOpen(percent, []() {
-        std::cout << "Move to Percent Open operation completed." << std::endl;
+    stepper.moveToPercentOpen(percent).then([](const MotionResult &result) {
+        std::cout << "Move to Percent Open operation " << motionOutcomeName(result.outcome)
+                  << " at step " << result.position << "." << std::endl;
     });
 }
 
@@ -130,9 +257,91 @@ void handleEmergencyStop(PiStepper& stepper) {
     stepper.emergencyStop();
 }
 
+void handlePlayTrajectory(TrajectoryPlayer& player) {
+    // Each line of the file is "<seconds> <percent open>"; lines starting with # are comments
+    std::string path;
+    std::cout << "Enter trajectory file: ";
+    std::cin >> path;
+    if (player.playFile(path.c_str())) {
+        std::cout << "Playing " << path << " in the background." << std::endl;
+    }
+}
+
+void handleClosedLoop(PiStepper& stepper, std::unique_ptr<FeedbackSource>& feedback,
+                      std::unique_ptr<PidController>& controller) {
+    // While the loop runs only the setpoint is asked for, x stops it
+    if (controller && controller->isRunning()) {
+        std::string input;
+        std::cout << "Measurement: " << controller->getMeasurement()
+                  << ", output: " << controller->getOutput() << "%" << std::endl;
+        std::cout << "Enter new setpoint, or x to stop: ";
+        std::cin >> input;
+        if (input == "x") {
+            controller->stop();
+        } else {
+            controller->setSetpoint(std::strtof(input.c_str(), nullptr));
+        }
+        return;
+    }
+
+    std::string source;
+    float setpoint;
+    std::cout << "Enter feedback file or FIFO (sim for a simulated plant): ";
+    std::cin >> source;
+    std::cout << "Enter setpoint: ";
+    std::cin >> setpoint;
+
+    controller.reset();
+    if (source == "sim") {
+        feedback.reset(new SimulatedPlant(stepper, 1.0f, 0.0f, 2.0f)); // Reads percent open through a 2 s lag
+    } else {
+        FileFeedback *file = new FileFeedback(source.c_str());
+        feedback.reset(file);
+        if (!file->isOpen()) {
+            return;
+        }
+    }
+    controller.reset(new PidController(stepper, *feedback));
+    controller->setSetpoint(setpoint);
+    if (controller->start()) {
+        std::cout << "Holding " << setpoint << " in the background." << std::endl;
+    }
+}
+
 void handleGetStatus(PiStepper& stepper) {
     std::cout << "Current Step Count: " << stepper.getCurrentStepCount() << std::endl;
     std::cout << "Full Range Count: " << stepper.getFullRangeCount() << std::endl;
     std::cout << "Percent Open: " << stepper.getPercentOpen() << "%" << std::endl;
     std::cout << "Moving: " << (stepper.isMoving() ? "Yes" : "No") << std::endl;
+    std::cout << "Position Trusted: " << (stepper.isPositionTrusted() ? "Yes" : "No") << std::endl;
+
+    ReferenceStats references = stepper.getReferenceStats();
+    std::cout << "Limit Switch References: " << references.references << std::endl;
+    std::cout << "Last Drift: " << references.lastDrift << " steps" << std::endl;
+    std::cout << "Largest Drift: " << references.maxDrift << " steps" << std::endl;
+    std::cout << "Missed-Step Alarm: " << (references.missedSteps ? "Raised" : "Clear") << std::endl;
+
+    StepTimingSnapshot timing = stepper.getTimingStats();
+    std::cout << "Step Edges: " << timing.steps << std::endl;
+    std::cout << "Overruns: " << timing.overruns << std::endl;
+    if (timing.steps == 0) {
+        return;
+    }
+    std::cout << "Mean Lateness: " << timing.totalLateness / timing.steps / 1000.0 << " us" << std::endl;
+    std::cout << "Worst Lateness: " << timing.worstLateness / 1000.0 << " us" << std::endl;
+    std::cout << "Lateness Histogram:" << std::endl;
+    for (int i = 0; i < TIMING_BUCKETS; i++) {
+        if (timing.buckets[i] == 0) {
+            continue;
+        }
+        uint64_t limit = StepTimingStats::bucketLimit(i);
+        uint64_t lower = i == 0 ? 0 : StepTimingStats::bucketLimit(i - 1);
+        std::cout << "  " << lower / 1000 << " us";
+        if (limit) {
+            std::cout << " - " << limit / 1000 << " us";
+        } else {
+            std::cout << " and up";
+        }
+        std::cout << ": " << timing.buckets[i] << std::endl;
+    }
 }
@@ -0,0 +1,159 @@
+#include "PidController.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <iostream>
+
+PidController::PidController(PiStepper &stepper, FeedbackSource &feedback) :
+    _stepper(stepper),
+    _feedback(feedback),
+    _setpoint(0),
+    _measurement(0),
+    _output(0),
+    _running(false),
+    _stopping(false)
+{
+}
+
+PidController::~PidController() {
+    stop();
+}
+
+void PidController::setOptions(const PidOptions &options) {
+    std::lock_guard<std::mutex> lock(_optionsMutex);
+    _options = options;
+    _options.sampleInterval = std::max(_options.sampleInterval, 1);
+    _options.outputMin = std::min(std::max(_options.outputMin, 0.0f), 100.0f);
+    _options.outputMax = std::min(std::max(_options.outputMax, _options.outputMin), 100.0f);
+    _options.deadband = std::max(_options.deadband, 1);
+}
+
+PidOptions PidController::getOptions() const {
+    std::lock_guard<std::mutex> lock(_optionsMutex);
+    return _options;
+}
+
+void PidController::setSetpoint(float setpoint) {
+    _setpoint = setpoint;
+}
+
+float PidController::getSetpoint() const {
+    return _setpoint;
+}
+
+bool PidController::start() {
+    stop();
+    if (!_stepper.isCalibrated()) {
+        std::cerr << "Calibration is required before closed-loop control." << std::endl;
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = false;
+    }
+    _running = true;
+    _loop = std::thread(&PidController::run, this);
+    return true;
+}
+
+void PidController::stop() {
+    bool wasRunning = _running;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    if (_loop.joinable()) {
+        _loop.join();
+    }
+    if (wasRunning) {
+        _stepper.stopMovement();
+    }
+}
+
+bool PidController::isRunning() const {
+    return _running;
+}
+
+float PidController::getMeasurement() const {
+    return _measurement;
+}
+
+float PidController::getOutput() const {
+    return _output;
+}
+
+void PidController::run() {
+    auto last = std::chrono::steady_clock::now();
+    auto lastReading = last;
+    auto tick = last;
+    float integral = _stepper.getPercentOpen(); // Bumpless start from the current opening
+    float previous = 0;
+    bool primed = false; // previous holds a measurement
+    int lastTarget = INT_MIN;
+
+    while (true) {
+        PidOptions options = getOptions();
+        tick += std::chrono::milliseconds(options.sampleInterval);
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_wake.wait_until(lock, tick, [this]() { return _stopping; })) {
+                break;
+            }
+        }
+        if (!_stepper.isCalibrated()) {
+            std::cerr << "Closed-loop control stopped, the valve is no longer calibrated." << std::endl;
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        float measurement;
+        if (!_feedback.read(measurement)) {
+            // Hold the output through a short gap in the feedback
+            if (now - lastReading > std::chrono::milliseconds(PID_FEEDBACK_TIMEOUT)) {
+                std::cerr << "Closed-loop control stopped, no feedback for "
+                          << PID_FEEDBACK_TIMEOUT << " ms." << std::endl;
+                break;
+            }
+            continue;
+        }
+        lastReading = now;
+        _measurement = measurement;
+
+        // Use the real interval, a late wake-up should not skew the I and D terms
+        float dt = std::chrono::duration<float>(now - last).count();
+        last = now;
+        if (dt <= 0) {
+            continue;
+        }
+
+        float error = _setpoint - measurement;
+        float proportional = options.kp * error;
+        float derivative = primed ? -options.kd * (measurement - previous) / dt : 0;
+        previous = measurement;
+        primed = true;
+
+        // Conditional integration: skip the increment while it would push a saturated output further
+        float increment = options.ki * error * dt;
+        float unclamped = proportional + integral + increment + derivative;
+        bool high = unclamped > options.outputMax && increment > 0;
+        bool low = unclamped < options.outputMin && increment < 0;
+        if (!high && !low) {
+            integral += increment;
+        }
+        integral = std::min(std::max(integral, options.outputMin), options.outputMax);
+
+        float output = std::min(std::max(proportional + integral + derivative, options.outputMin), options.outputMax);
+        _output = output;
+
+        int range = _stepper.getFullRangeCount();
+        int target = std::min(std::max(static_cast<int>(std::lround(output / 100.0f * range)), 0), range);
+        if (lastTarget == INT_MIN || std::abs(target - lastTarget) >= options.deadband) {
+            if (_stepper.moveToStepAsync(target, MotionQueue::ReplacePending, nullptr)) {
+                lastTarget = target;
+            }
+        }
+    }
+    _running = false;
+}
@@ -0,0 +1,76 @@
+#ifndef PidController_h
+#define PidController_h
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "FeedbackSource.h"
+#include "PiStepper.h"
+
+#define PID_SAMPLE_INTERVAL 100 // ms between control updates
+#define PID_KP 2.0f // Percent open per unit of error
+#define PID_KI 0.5f // Percent open per unit of error per second
+#define PID_KD 0.0f // Percent open per unit of measurement change per second
+#define PID_DEADBAND 1 // Steps the output has to change by before the valve is moved
+#define PID_FEEDBACK_TIMEOUT 2000 // ms without a measurement before control is abandoned
+
+// Controller settings
+struct PidOptions {
+    float kp = PID_KP;
+    float ki = PID_KI;
+    float kd = PID_KD;
+    int sampleInterval = PID_SAMPLE_INTERVAL; // ms
+    float outputMin = 0; // Percent open
+    float outputMax = 100; // Percent open
+    int deadband = PID_DEADBAND; // Steps
+};
+
+// Holds a process variable at a setpoint by positioning the valve. The loop
+// runs on its own thread every sampleInterval ms, independent of the step
+// timing: each sample reads the FeedbackSource, computes a percent open and
+// steers the running move toward it with a ReplacePending command, so the
+// valve is retargeted while moving instead of stopping between samples.
+//
+// The derivative acts on the measurement, so setpoint changes do not kick
+// the output. Anti-windup is by conditional integration: while the output
+// is saturated, error that would drive it further into the limit is not
+// integrated. The integral starts at the valve's current opening, so
+// starting the loop does not bump the valve. Negative gains give a reverse
+// acting loop, for a process variable that falls as the valve opens.
+class PidController {
+public:
+    PidController(PiStepper &stepper, FeedbackSource &feedback);
+    ~PidController();
+
+    void setOptions(const PidOptions &options); // Takes effect at the next sample
+    PidOptions getOptions() const;
+    void setSetpoint(float setpoint);
+    float getSetpoint() const;
+
+    bool start(); // Start the control loop
+    void stop(); // Stop the control loop, the valve stops where it is
+    bool isRunning() const;
+
+    float getMeasurement() const; // Last measurement read
+    float getOutput() const; // Last output in percent open
+
+private:
+    void run(); // Control thread body
+
+    PiStepper &_stepper;
+    FeedbackSource &_feedback;
+    mutable std::mutex _optionsMutex;
+    PidOptions _options; // Guarded by _optionsMutex
+    std::atomic<float> _setpoint;
+    std::atomic<float> _measurement;
+    std::atomic<float> _output;
+    std::atomic<bool> _running;
+
+    std::mutex _mutex;
+    std::condition_variable _wake; // The control thread sleeps here between samples
+    bool _stopping; // Guarded by _mutex
+    std::thread _loop;
+};
+
+#endif // PidController_h
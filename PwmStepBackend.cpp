@@ -0,0 +1,224 @@
+#include "PwmStepBackend.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+PwmStepBackend::PwmStepBackend(std::unique_ptr<GpioBackend> gpio, const char *root, int chip, int channel) :
+    _gpio(std::move(gpio)),
+    _chipPath(std::string(root) + "/pwmchip" + std::to_string(chip)),
+    _channelPath(_chipPath + "/pwm" + std::to_string(channel)),
+    _channel(channel),
+    _exported(false),
+    _periodFd(-1),
+    _dutyFd(-1),
+    _enableFd(-1),
+    _period(0),
+    _running(false),
+    _firstEdge(0),
+    _pulseCount(0),
+    _writeLatency(0),
+    _refusedPeriod(0)
+{
+    // Export the channel unless another process already did; udev may take a moment to set it up
+    struct stat info;
+    if (stat(_channelPath.c_str(), &info) != 0) {
+        int exportFd = open((_chipPath + "/export").c_str(), O_WRONLY | O_CLOEXEC);
+        if (exportFd < 0 || !writeAttribute(exportFd, channel)) {
+            std::cerr << "Failed to export PWM channel " << channel << " of " << _chipPath << std::endl;
+            if (exportFd >= 0) {
+                close(exportFd);
+            }
+            return;
+        }
+        close(exportFd);
+        _exported = true;
+        for (int waited = 0; stat(_channelPath.c_str(), &info) != 0 && waited < PWM_EXPORT_TIMEOUT; waited += 10) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    // Keep the attributes open, each train start and stop is then a single write
+    _periodFd = openAttribute("period");
+    _dutyFd = openAttribute("duty_cycle");
+    _enableFd = openAttribute("enable");
+    if (_enableFd >= 0) {
+        writeAttribute(_enableFd, 0);
+    }
+}
+
+PwmStepBackend::~PwmStepBackend() {
+    if (_running) {
+        stopPulses();
+    }
+    for (int fd : {_periodFd, _dutyFd, _enableFd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (_exported) {
+        int unexportFd = open((_chipPath + "/unexport").c_str(), O_WRONLY | O_CLOEXEC);
+        if (unexportFd >= 0) {
+            writeAttribute(unexportFd, _channel);
+            close(unexportFd);
+        }
+    }
+}
+
+bool PwmStepBackend::isOpen() const {
+    return _gpio->isOpen();
+}
+
+void PwmStepBackend::setStep(int value) {
+    _gpio->setStep(value);
+}
+
+void PwmStepBackend::setDirection(int value) {
+    _gpio->setDirection(value);
+}
+
+void PwmStepBackend::setEnable(int value) {
+    _gpio->setEnable(value);
+}
+
+int PwmStepBackend::readLimitTop() {
+    return _gpio->readLimitTop();
+}
+
+int PwmStepBackend::readLimitBottom() {
+    return _gpio->readLimitBottom();
+}
+
+void PwmStepBackend::setStepDirection(int step, int direction) {
+    _gpio->setStepDirection(step, direction);
+}
+
+void PwmStepBackend::readLimits(int &top, int &bottom) {
+    _gpio->readLimits(top, bottom);
+}
+
+int PwmStepBackend::triggeredLimits() {
+    return _gpio->triggeredLimits();
+}
+
+void PwmStepBackend::clearLimitLatch() {
+    _gpio->clearLimitLatch();
+}
+
+uint64_t PwmStepBackend::limitClosedAt(int flag) {
+    return _gpio->limitClosedAt(flag);
+}
+
+int PwmStepBackend::waitForLimits(int flags, uint64_t deadline) {
+    return _gpio->waitForLimits(flags, deadline);
+}
+
+bool PwmStepBackend::setMicrostepLines(int ms1, int ms2, int ms3) {
+    return _gpio->setMicrostepLines(ms1, ms2, ms3);
+}
+
+bool PwmStepBackend::hasPulseGenerator() const {
+    return _periodFd >= 0 && _dutyFd >= 0 && _enableFd >= 0;
+}
+
+bool PwmStepBackend::startPulses(uint64_t period, uint64_t &firstEdge) {
+    if (!hasPulseGenerator() || _running || period < 2) {
+        return false;
+    }
+
+    // The count is only right while a quarter period covers the uncertainty of the edges
+    if (_writeLatency > period / 4) {
+        if (period != _refusedPeriod) {
+            std::cerr << "PWM attribute writes take up to " << _writeLatency / 1000 << " us, more than a quarter of the "
+                      << period / 1000 << " us period; bit-banging instead." << std::endl;
+            _refusedPeriod = period;
+        }
+        return false;
+    }
+
+    // The duty cycle may never exceed the period, so the order depends on which way the period moves
+    if (period != _period) {
+        bool ok = period < _period ?
+            writeAttribute(_dutyFd, period / 2) && writeAttribute(_periodFd, period) :
+            writeAttribute(_periodFd, period) && writeAttribute(_dutyFd, period / 2);
+        if (!ok) {
+            _period = 0; // Unknown, rewrite everything next time
+            return false;
+        }
+        _period = period;
+    }
+
+    // The train starts somewhere inside the write, take the middle of it
+    uint64_t before = _gpio->now();
+    if (!writeAttribute(_enableFd, 1)) {
+        return false;
+    }
+    _firstEdge = before + (_gpio->now() - before) / 2;
+    _running = true;
+    firstEdge = _firstEdge;
+    return true;
+}
+
+int PwmStepBackend::stopPulses() {
+    if (!_running) {
+        return 0;
+    }
+    uint64_t before = _gpio->now();
+    writeAttribute(_enableFd, 0);
+    uint64_t stopped = before + (_gpio->now() - before) / 2;
+    _running = false;
+
+    // Pulses rise at _firstEdge + k * period, count those that started before the stop
+    uint64_t elapsed = stopped > _firstEdge ? stopped - _firstEdge : 0;
+    int pulses = static_cast<int>((elapsed + _period - 1) / _period);
+    _pulseCount += pulses;
+    return pulses;
+}
+
+uint64_t PwmStepBackend::now() {
+    return _gpio->now();
+}
+
+void PwmStepBackend::sleepUntil(uint64_t deadline) {
+    _gpio->sleepUntil(deadline);
+}
+
+GpioBackend &PwmStepBackend::gpio() {
+    return *_gpio;
+}
+
+uint64_t PwmStepBackend::getPulseCount() const {
+    return _pulseCount;
+}
+
+uint64_t PwmStepBackend::getWriteLatency() const {
+    return _writeLatency;
+}
+
+bool PwmStepBackend::writeAttribute(int fd, uint64_t value) {
+    // Attributes are rewritten from the start; the newline ends the value in a plain file too
+    char text[32];
+    int length = std::snprintf(text, sizeof(text), "%llu\n", static_cast<unsigned long long>(value));
+    uint64_t before = _gpio->now();
+    bool written = pwrite(fd, text, length, 0) == length;
+    _writeLatency = std::max(_writeLatency, _gpio->now() - before);
+    if (!written) {
+        std::cerr << "Failed to write PWM attribute: " << std::strerror(errno) << std::endl;
+    }
+    return written;
+}
+
+int PwmStepBackend::openAttribute(const char *name) {
+    std::string path = _channelPath + "/" + name;
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << path << ": " << std::strerror(errno) << std::endl;
+    }
+    return fd;
+}
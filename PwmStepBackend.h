@@ -0,0 +1,75 @@
+#ifndef PwmStepBackend_h
+#define PwmStepBackend_h
+
+#include <memory>
+#include <string>
+#include "GpioBackend.h"
+
+#define PWM_SYSFS_ROOT "/sys/class/pwm"
+#define PWM_EXPORT_TIMEOUT 1000 // ms to wait for an exported channel to appear
+
+// GpioBackend that adds a hardware PWM channel to another backend, which
+// still drives every line itself. The PWM output and the step line are
+// combined into the driver's STEP input, for example with an OR gate, so
+// whichever is idle stays low. PiStepper bit-bangs the ramps and hands the
+// cruise phase of long moves to the PWM channel.
+//
+// The channel is programmed through the pwm sysfs interface under root,
+// normally PWM_SYSFS_ROOT; pointing root at a directory tree of plain files
+// with the same layout runs the backend without hardware. Pulses are not
+// counted by the hardware: the count is worked out from the time between
+// enabling and disabling the channel, so stops have to be timed away from
+// a rising edge. Each edge is placed in the middle of the write that made
+// it, so every attribute write is timed, and startPulses() refuses a
+// period whose quarter does not cover the longest write seen.
+class PwmStepBackend : public GpioBackend {
+public:
+    PwmStepBackend(std::unique_ptr<GpioBackend> gpio, const char *root, int chip, int channel);
+    ~PwmStepBackend();
+
+    bool isOpen() const override;
+    void setStep(int value) override;
+    void setDirection(int value) override;
+    void setEnable(int value) override;
+    int readLimitTop() override;
+    int readLimitBottom() override;
+    void setStepDirection(int step, int direction) override;
+    void readLimits(int &top, int &bottom) override;
+    int triggeredLimits() override;
+    void clearLimitLatch() override;
+    uint64_t limitClosedAt(int flag) override;
+    int waitForLimits(int flags, uint64_t deadline) override;
+    bool setMicrostepLines(int ms1, int ms2, int ms3) override;
+
+    bool hasPulseGenerator() const override;
+    bool startPulses(uint64_t period, uint64_t &firstEdge) override;
+    int stopPulses() override;
+
+    uint64_t now() override;
+    void sleepUntil(uint64_t deadline) override;
+
+    GpioBackend &gpio(); // The backend driving the lines
+    uint64_t getPulseCount() const; // Pulses sent by the PWM channel since construction
+    uint64_t getWriteLatency() const; // ns taken by the longest attribute write since construction
+
+private:
+    bool writeAttribute(int fd, uint64_t value); // Write a decimal value to an open sysfs attribute
+    int openAttribute(const char *name); // Open an attribute of the channel for writing
+
+    std::unique_ptr<GpioBackend> _gpio;
+    std::string _chipPath; // root/pwmchipN
+    std::string _channelPath; // root/pwmchipN/pwmM
+    int _channel;
+    bool _exported; // The channel was exported here and is unexported on destruction
+    int _periodFd;
+    int _dutyFd;
+    int _enableFd;
+    uint64_t _period; // Period last written, 0 before the first train
+    bool _running;
+    uint64_t _firstEdge; // now() time the running train started
+    uint64_t _pulseCount;
+    uint64_t _writeLatency; // Longest attribute write in ns
+    uint64_t _refusedPeriod; // Last period refused for write latency, to report each once
+};
+
+#endif // PwmStepBackend_h
@@ -0,0 +1,91 @@
+#include "RotatingLogFile.h"
+#include <cstdio>
+#include <iostream>
+
+RotatingLogFile::RotatingLogFile(const std::string &path, size_t maxBytes, int backups) :
+    _path(path),
+    _maxBytes(maxBytes),
+    _backups(backups),
+    _size(0),
+    _dropped(0),
+    _closing(false)
+{
+    _file.open(_path, std::ios::app);
+    if (!_file) {
+        std::cerr << "Failed to open log file " << _path << std::endl;
+        return;
+    }
+    _file.seekp(0, std::ios::end);
+    _size = _file.tellp();
+    _writer = std::thread(&RotatingLogFile::run, this);
+}
+
+RotatingLogFile::~RotatingLogFile() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closing = true;
+    }
+    _wake.notify_one();
+    if (_writer.joinable()) {
+        _writer.join();
+    }
+}
+
+bool RotatingLogFile::isOpen() const {
+    return _writer.joinable();
+}
+
+void RotatingLogFile::append(const std::string &line) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending.size() >= LOG_FILE_QUEUE_SIZE) {
+            _dropped++;
+            return;
+        }
+        _pending.push_back(line);
+    }
+    _wake.notify_one();
+}
+
+size_t RotatingLogFile::droppedLines() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _dropped;
+}
+
+void RotatingLogFile::run() {
+    std::deque<std::string> lines;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [this]() { return _closing || !_pending.empty(); });
+        if (_pending.empty()) {
+            break; // Closing with everything written
+        }
+
+        // Write the whole batch without holding the lock
+        lines.swap(_pending);
+        lock.unlock();
+        for (const std::string &line : lines) {
+            if (_size >= _maxBytes) {
+                rotate();
+            }
+            _file << line << '\n';
+            _size += line.size() + 1;
+        }
+        _file.flush();
+        lines.clear();
+        lock.lock();
+    }
+}
+
+void RotatingLogFile::rotate() {
+    _file.close();
+    std::remove((_path + "." + std::to_string(_backups)).c_str());
+    for (int i = _backups - 1; i >= 1; i--) {
+        std::rename((_path + "." + std::to_string(i)).c_str(), (_path + "." + std::to_string(i + 1)).c_str());
+    }
+    if (_backups > 0) {
+        std::rename(_path.c_str(), (_path + ".1").c_str());
+    }
+    _file.open(_path, std::ios::trunc);
+    _size = 0;
+}
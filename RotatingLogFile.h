@@ -0,0 +1,48 @@
+#ifndef RotatingLogFile_h
+#define RotatingLogFile_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define LOG_FILE_MAX_BYTES (1024 * 1024) // Size at which the log file is rotated
+#define LOG_FILE_BACKUPS 3 // Rotated files kept as path.1 ... path.N
+#define LOG_FILE_QUEUE_SIZE 1024 // Lines waiting for the writer before new ones are dropped
+
+// Appends lines to a log file from a background thread, so callers never
+// wait on the disk. When the file passes maxBytes it is renamed to path.1,
+// older copies shift up to path.N and the oldest is deleted. If the writer
+// falls behind by more than LOG_FILE_QUEUE_SIZE lines, new lines are
+// dropped and counted rather than queued without bound.
+class RotatingLogFile {
+public:
+    RotatingLogFile(const std::string &path, size_t maxBytes, int backups);
+    ~RotatingLogFile();
+
+    bool isOpen() const; // Check if the file could be opened
+    void append(const std::string &line); // Queue a line, the newline is added
+    size_t droppedLines() const; // Lines lost because the queue was full
+
+private:
+    void run(); // Writer thread body
+    void rotate(); // Shift the backups and start a new file, writer only
+
+    std::string _path;
+    size_t _maxBytes;
+    int _backups;
+    std::ofstream _file;
+    size_t _size; // Bytes in the current file, writer only
+
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    std::deque<std::string> _pending; // Guarded by _mutex
+    size_t _dropped; // Guarded by _mutex
+    bool _closing; // Guarded by _mutex
+    std::thread _writer;
+};
+
+#endif // RotatingLogFile_h
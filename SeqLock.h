@@ -0,0 +1,67 @@
+#ifndef SeqLock_h
+#define SeqLock_h
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Single-writer sequence lock. The writer never blocks; readers never
+// block the writer and retry only if they overlap a store. The value is
+// kept in relaxed atomic words so concurrent access stays well defined.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable type");
+
+public:
+    SeqLock() : _sequence(0) {
+        T value{};
+        store(value);
+    }
+
+    void store(const T &value) {
+        uint32_t buffer[WordCount] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+        uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+        _sequence.store(sequence + 1, std::memory_order_relaxed); // Odd while the words change
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int i = 0; i < WordCount; i++) {
+            _words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+        _sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    T load() const {
+        T value;
+        while (!tryLoad(value, 1)) {
+        }
+        return value;
+    }
+
+    // Give up after attempts overlapping stores, for readers in another
+    // process that cannot rely on the writer ever finishing one
+    bool tryLoad(T &value, int attempts) const {
+        uint32_t buffer[WordCount];
+        for (int attempt = 0; attempt < attempts; attempt++) {
+            uint32_t before = _sequence.load(std::memory_order_acquire);
+            for (int i = 0; i < WordCount; i++) {
+                buffer[i] = _words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint32_t after = _sequence.load(std::memory_order_relaxed);
+            if (before == after && !(before & 1)) {
+                std::memcpy(&value, buffer, sizeof(T));
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static constexpr int WordCount = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    std::atomic<uint32_t> _sequence;
+    std::atomic<uint32_t> _words[WordCount];
+};
+
+#endif // SeqLock_h
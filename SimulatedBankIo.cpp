@@ -0,0 +1,63 @@
+#include "SimulatedBankIo.h"
+
+SimulatedBankIo::SimulatedBankIo(int channelCount, int bottomLimit, int topLimit, int startPosition) :
+    _channelCount(channelCount < MAX_BANK_CHANNELS ? channelCount : MAX_BANK_CHANNELS)
+{
+    for (int i = 0; i < _channelCount; i++) {
+        _valves[i].reset(new SimulatedValve(bottomLimit, topLimit, startPosition));
+    }
+}
+
+int SimulatedBankIo::channelCount() const {
+    return _channelCount;
+}
+
+bool SimulatedBankIo::isOpen() const {
+    return true;
+}
+
+void SimulatedBankIo::writeSteps(uint32_t mask) {
+    for (int i = 0; i < _channelCount; i++) {
+        _valves[i]->setStep((mask >> i) & 1);
+    }
+}
+
+void SimulatedBankIo::writeDirections(uint32_t mask) {
+    for (int i = 0; i < _channelCount; i++) {
+        _valves[i]->setDirection((mask >> i) & 1);
+    }
+}
+
+void SimulatedBankIo::writeEnables(uint32_t mask) {
+    for (int i = 0; i < _channelCount; i++) {
+        _valves[i]->setEnable((mask >> i) & 1);
+    }
+}
+
+void SimulatedBankIo::readLimits(uint32_t &top, uint32_t &bottom) {
+    top = 0;
+    bottom = 0;
+    for (int i = 0; i < _channelCount; i++) {
+        int limits = _valves[i]->triggeredLimits();
+        if (limits & GpioBackend::LimitTop) {
+            top |= 1u << i;
+        }
+        if (limits & GpioBackend::LimitBottom) {
+            bottom |= 1u << i;
+        }
+    }
+}
+
+uint64_t SimulatedBankIo::now() {
+    return _channelCount > 0 ? _valves[0]->now() : 0;
+}
+
+void SimulatedBankIo::sleepUntil(uint64_t deadline) {
+    for (int i = 0; i < _channelCount; i++) {
+        _valves[i]->sleepUntil(deadline);
+    }
+}
+
+SimulatedValve &SimulatedBankIo::valve(int channel) {
+    return *_valves[channel];
+}
@@ -0,0 +1,30 @@
+#ifndef SimulatedBankIo_h
+#define SimulatedBankIo_h
+
+#include <memory>
+#include "BankIo.h"
+#include "SimulatedValve.h"
+
+// BankIo over a set of SimulatedValves that share one virtual clock
+class SimulatedBankIo : public BankIo {
+public:
+    SimulatedBankIo(int channelCount, int bottomLimit, int topLimit, int startPosition);
+
+    int channelCount() const override;
+    bool isOpen() const override;
+    void writeSteps(uint32_t mask) override;
+    void writeDirections(uint32_t mask) override;
+    void writeEnables(uint32_t mask) override;
+    void readLimits(uint32_t &top, uint32_t &bottom) override;
+
+    uint64_t now() override;
+    void sleepUntil(uint64_t deadline) override;
+
+    SimulatedValve &valve(int channel); // Simulation state and controls for one channel
+
+private:
+    int _channelCount;
+    std::unique_ptr<SimulatedValve> _valves[MAX_BANK_CHANNELS];
+};
+
+#endif // SimulatedBankIo_h
@@ -0,0 +1,27 @@
+#include "SimulatedPlant.h"
+#include <cmath>
+
+SimulatedPlant::SimulatedPlant(const PiStepper &stepper, float gain, float offset, float timeConstant) :
+    _stepper(stepper),
+    _gain(gain),
+    _offset(offset),
+    _timeConstant(timeConstant),
+    _lastUpdate(std::chrono::steady_clock::now())
+{
+    _value = _gain * (_stepper.getFullRangeCount() > 0 ? _stepper.getPercentOpen() : 0) + _offset;
+}
+
+bool SimulatedPlant::read(float &value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto now = std::chrono::steady_clock::now();
+    float elapsed = std::chrono::duration<float>(now - _lastUpdate).count();
+    _lastUpdate = now;
+
+    // Exact step response of the lag over the elapsed time, with the valve held where it is now
+    float percent = _stepper.getFullRangeCount() > 0 ? _stepper.getPercentOpen() : 0;
+    float target = _gain * percent + _offset;
+    float blend = _timeConstant > 0 ? 1.0f - std::exp(-elapsed / _timeConstant) : 1.0f;
+    _value += (target - _value) * blend;
+    value = _value;
+    return true;
+}
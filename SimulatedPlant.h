@@ -0,0 +1,29 @@
+#ifndef SimulatedPlant_h
+#define SimulatedPlant_h
+
+#include <chrono>
+#include <mutex>
+#include "FeedbackSource.h"
+#include "PiStepper.h"
+
+// First-order process downstream of a valve, for trying out a PidController
+// without a real sensor. The process variable settles toward
+// gain * percentOpen + offset with the given time constant, following the
+// stepper's actual position in real time.
+class SimulatedPlant : public FeedbackSource {
+public:
+    SimulatedPlant(const PiStepper &stepper, float gain, float offset, float timeConstant);
+
+    bool read(float &value) override;
+
+private:
+    const PiStepper &_stepper;
+    float _gain;
+    float _offset;
+    float _timeConstant; // Seconds
+    std::mutex _mutex;
+    float _value; // Guarded by _mutex
+    std::chrono::steady_clock::time_point _lastUpdate; // Guarded by _mutex
+};
+
+#endif // SimulatedPlant_h
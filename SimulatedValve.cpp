@@ -0,0 +1,143 @@
+#include "SimulatedValve.h"
+#include <algorithm>
+
+SimulatedValve::SimulatedValve(int bottomLimit, int topLimit, int startPosition) :
+    _bottomLimit(bottomLimit),
+    _topLimit(topLimit),
+    _overtravel(SIMULATED_OVERTRAVEL),
+    _position(startPosition),
+    _step(0),
+    _direction(0),
+    _enable(0),
+    _stepCount(0),
+    _missedSteps(0),
+    _clock(0),
+    _lastStepTime(0),
+    _minStepInterval(0),
+    _resolution(0),
+    _mode(0),
+    _phase(0)
+{
+}
+
+bool SimulatedValve::isOpen() const {
+    return true;
+}
+
+void SimulatedValve::setStep(int value) {
+    int previous = _step.exchange(value);
+    if (previous != 0 || value == 0 || !_enable) {
+        return; // Only rising edges on an enabled driver move the shaft
+    }
+    _stepCount++;
+
+    // The translator advances whether or not the shaft can follow
+    int distance = 1;
+    int resolution = _resolution;
+    int mode = _mode;
+    if (resolution > 0 && mode > 0 && mode <= resolution) {
+        int stride = resolution / mode;
+        int offset = ((_phase % stride) + stride) % stride;
+        distance = _direction ? stride - offset : (offset ? offset : stride);
+    }
+    _phase += _direction ? distance : -distance;
+
+    uint64_t time = _clock;
+    uint64_t last = _lastStepTime.exchange(time);
+    if (_minStepInterval && last && time - last < _minStepInterval) {
+        _missedSteps++; // Pulses came faster than the rotor can follow
+        return;
+    }
+
+    // The end stops sit overtravel beyond the switches
+    int position = _position;
+    int overtravel = _overtravel;
+    if (_direction) {
+        if (position >= _topLimit + overtravel) {
+            _missedSteps++;
+            return;
+        }
+        _position = std::min(position + distance, _topLimit + overtravel);
+    } else {
+        if (position <= _bottomLimit - overtravel) {
+            _missedSteps++;
+            return;
+        }
+        _position = std::max(position - distance, _bottomLimit - overtravel);
+    }
+}
+
+void SimulatedValve::setDirection(int value) {
+    _direction = value;
+}
+
+void SimulatedValve::setEnable(int value) {
+    _enable = value;
+}
+
+int SimulatedValve::readLimitTop() {
+    return _position >= _topLimit ? 0 : 1;
+}
+
+int SimulatedValve::readLimitBottom() {
+    return _position <= _bottomLimit ? 0 : 1;
+}
+
+int SimulatedValve::triggeredLimits() {
+    int position = _position;
+    return (position >= _topLimit ? LimitTop : 0) | (position <= _bottomLimit ? LimitBottom : 0);
+}
+
+bool SimulatedValve::setMicrostepLines(int ms1, int ms2, int ms3) {
+    if (_resolution <= 0) {
+        return false;
+    }
+    _mode = microstepDivisor(ms1, ms2, ms3);
+    return true;
+}
+
+uint64_t SimulatedValve::now() {
+    return _clock;
+}
+
+void SimulatedValve::sleepUntil(uint64_t deadline) {
+    uint64_t current = _clock;
+    while (deadline > current && !_clock.compare_exchange_weak(current, deadline)) {
+    }
+}
+
+void SimulatedValve::setStallRate(float stepsPerSecond) {
+    _minStepInterval = stepsPerSecond > 0 ? static_cast<uint64_t>(1e9 / stepsPerSecond) : 0;
+}
+
+void SimulatedValve::setPosition(int position) {
+    _position = position;
+}
+
+void SimulatedValve::setOvertravel(int positions) {
+    _overtravel = std::max(positions, 0);
+}
+
+void SimulatedValve::setMicrostepResolution(int microstepping) {
+    _resolution = microstepping;
+}
+
+int SimulatedValve::getPosition() const {
+    return _position;
+}
+
+int SimulatedValve::getMicrostepMode() const {
+    return _mode;
+}
+
+long SimulatedValve::getStepCount() const {
+    return _stepCount;
+}
+
+long SimulatedValve::getMissedSteps() const {
+    return _missedSteps;
+}
+
+uint64_t SimulatedValve::getClock() const {
+    return _clock;
+}
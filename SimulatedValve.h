@@ -0,0 +1,67 @@
+#ifndef SimulatedValve_h
+#define SimulatedValve_h
+
+#include <atomic>
+#include "GpioBackend.h"
+
+#define SIMULATED_OVERTRAVEL 1000 // Positions the shaft can run past a switch before it meets the end stop
+
+// GpioBackend that models a valve in software. The valve travels between
+// two limit switches at configurable step positions, which stay closed over
+// an overtravel zone ending in a mechanical end stop, and runs on a virtual
+// clock: sleeping only advances the clock, so moves complete as fast as the
+// control logic can issue them and always produce the same timing.
+//
+// With a microstep resolution set, positions are in 1/resolution of a full
+// step and each pulse moves by the mode the MS lines select. Like the
+// translator of an A4988, a coarse pulse taken from a position off that
+// mode's grid only reaches the next grid point, so a mode switch at the
+// wrong moment shows up as lost position.
+class SimulatedValve : public GpioBackend {
+public:
+    SimulatedValve(int bottomLimit, int topLimit, int startPosition);
+
+    bool isOpen() const override;
+    void setStep(int value) override;
+    void setDirection(int value) override;
+    void setEnable(int value) override;
+    int readLimitTop() override;
+    int readLimitBottom() override;
+    int triggeredLimits() override;
+    bool setMicrostepLines(int ms1, int ms2, int ms3) override;
+
+    uint64_t now() override;
+    void sleepUntil(uint64_t deadline) override;
+
+    // Simulation controls
+    void setStallRate(float stepsPerSecond); // Step rate above which pulses are lost, 0 to never stall
+    void setPosition(int position); // Move the valve without stepping
+    void setOvertravel(int positions); // Distance from each switch to its end stop, 0 to stop at the switch
+    void setMicrostepResolution(int microstepping); // Microsteps per full step the positions count, 0 if the MS lines are not wired
+
+    // Simulation state
+    int getPosition() const; // Shaft position in steps
+    int getMicrostepMode() const; // Divisor the MS lines select, 0 if they were never driven
+    long getStepCount() const; // Step pulses received while enabled
+    long getMissedSteps() const; // Pulses that did not move the shaft
+    uint64_t getClock() const; // Virtual time in nanoseconds
+
+private:
+    int _bottomLimit;
+    int _topLimit;
+    std::atomic<int> _overtravel;
+    std::atomic<int> _position;
+    std::atomic<int> _step;
+    std::atomic<int> _direction;
+    std::atomic<int> _enable;
+    std::atomic<long> _stepCount;
+    std::atomic<long> _missedSteps;
+    std::atomic<uint64_t> _clock;
+    std::atomic<uint64_t> _lastStepTime;
+    std::atomic<uint64_t> _minStepInterval; // Shortest pulse spacing the motor follows, in ns
+    std::atomic<int> _resolution; // Position units per full step, 0 when microstepping is not modelled
+    std::atomic<int> _mode; // Selected microstep divisor
+    std::atomic<int> _phase; // Translator position in position units, from power-up
+};
+
+#endif // SimulatedValve_h
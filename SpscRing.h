@@ -0,0 +1,53 @@
+#ifndef SpscRing_h
+#define SpscRing_h
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Fixed-capacity single-producer/single-consumer queue. push() and pop()
+// never block or allocate, so the producer can sit in the step loop. One
+// thread may push and one other thread may pop; Capacity must be a power
+// of two.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    SpscRing() : _head(0), _tail(0) {}
+
+    // Producer: add an item, false if the ring is full
+    bool push(const T &item) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        _slots[head & (Capacity - 1)] = item;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: move up to max items into out and return how many
+    size_t pop(T *out, size_t max) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        size_t available = _head.load(std::memory_order_acquire) - tail;
+        size_t count = available < max ? available : max;
+        for (size_t i = 0; i < count; i++) {
+            out[i] = _slots[(tail + i) & (Capacity - 1)];
+        }
+        _tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer: drop everything queued so far
+    void clear() {
+        _tail.store(_head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    alignas(64) std::atomic<size_t> _head; // Next slot to write, producer only
+    alignas(64) std::atomic<size_t> _tail; // Next slot to read, consumer only
+    std::array<T, Capacity> _slots;
+};
+
+#endif // SpscRing_h
@@ -0,0 +1,125 @@
+#include "StateJournal.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC 0x56414c56 // "VALV"
+#define JOURNAL_SLOTS 2
+
+StateJournal::StateJournal() :
+    _fd(-1),
+    _slots(nullptr),
+    _sequence(0)
+{
+}
+
+StateJournal::~StateJournal() {
+    close();
+}
+
+bool StateJournal::open(const char *path) {
+    close();
+    _fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        std::cerr << "Failed to open state journal " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // A new file reads back as zeros, which no slot accepts
+    size_t size = sizeof(Slot) * JOURNAL_SLOTS;
+    if (ftruncate(_fd, size) != 0) {
+        std::cerr << "Failed to size state journal " << path << ": " << std::strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED) {
+        std::cerr << "Failed to map state journal " << path << ": " << std::strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    _slots = static_cast<Slot *>(map);
+
+    _sequence = 0;
+    for (int i = 0; i < JOURNAL_SLOTS; i++) {
+        if (valid(_slots[i]) && _slots[i].sequence > _sequence) {
+            _sequence = _slots[i].sequence;
+        }
+    }
+    return true;
+}
+
+void StateJournal::close() {
+    if (_slots) {
+        msync(_slots, sizeof(Slot) * JOURNAL_SLOTS, MS_SYNC);
+        munmap(_slots, sizeof(Slot) * JOURNAL_SLOTS);
+        _slots = nullptr;
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+bool StateJournal::isOpen() const {
+    return _slots != nullptr;
+}
+
+bool StateJournal::read(JournalEntry &entry) const {
+    if (!_slots) {
+        return false;
+    }
+    const Slot *newest = nullptr;
+    for (int i = 0; i < JOURNAL_SLOTS; i++) {
+        if (valid(_slots[i]) && (!newest || _slots[i].sequence > newest->sequence)) {
+            newest = &_slots[i];
+        }
+    }
+    if (!newest) {
+        return false;
+    }
+    entry.fullRange = newest->fullRange;
+    entry.position = newest->position;
+    entry.calibrated = newest->flags & SlotCalibrated;
+    entry.trusted = newest->flags & SlotTrusted;
+    return true;
+}
+
+void StateJournal::write(const JournalEntry &entry, bool sync) {
+    if (!_slots) {
+        return;
+    }
+
+    // Overwrite the older slot; the newer one stays intact until this one checks out
+    Slot slot;
+    slot.magic = JOURNAL_MAGIC;
+    slot.sequence = _sequence + 1;
+    slot.fullRange = entry.fullRange;
+    slot.position = entry.position;
+    slot.flags = (entry.calibrated ? SlotCalibrated : 0) | (entry.trusted ? SlotTrusted : 0);
+    slot.checksum = checksum(slot);
+    std::memcpy(&_slots[slot.sequence % JOURNAL_SLOTS], &slot, sizeof(Slot));
+    _sequence = slot.sequence;
+
+    if (sync) {
+        msync(_slots, sizeof(Slot) * JOURNAL_SLOTS, MS_SYNC);
+    }
+}
+
+uint32_t StateJournal::checksum(const Slot &slot) {
+    // FNV-1a over the fields in front of the checksum
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&slot);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(Slot, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+bool StateJournal::valid(const Slot &slot) const {
+    return slot.magic == JOURNAL_MAGIC && slot.checksum == checksum(slot);
+}
@@ -0,0 +1,53 @@
+#ifndef StateJournal_h
+#define StateJournal_h
+
+#include <cstdint>
+
+#define STATE_JOURNAL_PATH "/var/tmp/motorized_valve.state"
+
+// Calibration and position as last recorded
+struct JournalEntry {
+    int fullRange = 0; // Steps from fully closed to fully open
+    int position = 0; // Step count
+    bool calibrated = false; // fullRange was measured
+    bool trusted = false; // Written by a clean shutdown with the motor at rest
+};
+
+// Small memory-mapped file holding the latest JournalEntry. The file has
+// two slots that are written alternately, each with a sequence number and
+// a checksum, so a crash or power loss part way through a write leaves the
+// previous entry readable. Not thread safe; PiStepper writes it from its
+// motion worker only.
+class StateJournal {
+public:
+    StateJournal();
+    ~StateJournal();
+
+    bool open(const char *path); // Map the file, creating it if needed
+    void close();
+    bool isOpen() const;
+
+    bool read(JournalEntry &entry) const; // Newest intact entry, false if there is none
+    void write(const JournalEntry &entry, bool sync); // Record an entry, with sync flushed to disk before returning
+
+private:
+    struct Slot {
+        uint32_t magic;
+        uint32_t sequence;
+        int32_t fullRange;
+        int32_t position;
+        uint32_t flags;
+        uint32_t checksum; // Covers every field above
+    };
+
+    enum SlotFlag { SlotCalibrated = 1, SlotTrusted = 2 };
+
+    static uint32_t checksum(const Slot &slot);
+    bool valid(const Slot &slot) const;
+
+    int _fd;
+    Slot *_slots; // Two slots in the mapping
+    uint32_t _sequence; // Sequence of the newest slot
+};
+
+#endif // StateJournal_h
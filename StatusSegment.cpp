@@ -0,0 +1,143 @@
+#include "StatusSegment.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+StatusPublisher::StatusPublisher() :
+    _segment(nullptr)
+{
+    _name[0] = '\0';
+}
+
+StatusPublisher::~StatusPublisher() {
+    close();
+}
+
+bool StatusPublisher::open(const char *name) {
+    close();
+    if (std::strlen(name) >= sizeof(_name)) {
+        std::cerr << "Status segment name is too long: " << name << std::endl;
+        return false;
+    }
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to open status segment " << name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, sizeof(StatusSegment)) != 0) {
+        std::cerr << "Failed to size status segment " << name << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, sizeof(StatusSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd); // The mapping keeps the segment
+    if (map == MAP_FAILED) {
+        std::cerr << "Failed to map status segment " << name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // A segment left by a publisher that crashed is taken over; readers
+    // still mapping it see it stopped until the header is rewritten. One
+    // whose publisher is still running belongs to another valve process.
+    StatusSegment *segment = static_cast<StatusSegment *>(map);
+    pid_t owner = segment->pid;
+    if (segment->magic.load(std::memory_order_acquire) == STATUS_SEGMENT_MAGIC && owner > 0 &&
+        (owner == getpid() || kill(owner, 0) == 0 || errno == EPERM)) {
+        std::cerr << "Status segment " << name << " is in use by process " << owner << std::endl;
+        munmap(map, sizeof(StatusSegment));
+        return false;
+    }
+    segment->magic.store(0, std::memory_order_relaxed);
+    new (&segment->status) SeqLock<ValveStatus>();
+    segment->version = STATUS_SEGMENT_VERSION;
+    segment->size = sizeof(StatusSegment);
+    segment->pid = getpid();
+    segment->magic.store(STATUS_SEGMENT_MAGIC, std::memory_order_release);
+    _segment = segment;
+    std::strcpy(_name, name);
+    return true;
+}
+
+void StatusPublisher::close() {
+    if (!_segment) {
+        return;
+    }
+    _segment->magic.store(0, std::memory_order_release);
+    munmap(_segment, sizeof(StatusSegment));
+    _segment = nullptr;
+    shm_unlink(_name);
+}
+
+bool StatusPublisher::isOpen() const {
+    return _segment != nullptr;
+}
+
+void StatusPublisher::publish(const ValveStatus &status) {
+    if (_segment) {
+        _segment->status.store(status);
+    }
+}
+
+StatusReader::StatusReader() :
+    _segment(nullptr)
+{
+}
+
+StatusReader::~StatusReader() {
+    close();
+}
+
+bool StatusReader::open(const char *name) {
+    close();
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(StatusSegment))) {
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, sizeof(StatusSegment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const StatusSegment *segment = static_cast<const StatusSegment *>(map);
+    if (segment->magic.load(std::memory_order_acquire) != STATUS_SEGMENT_MAGIC ||
+        segment->version != STATUS_SEGMENT_VERSION || segment->size != sizeof(StatusSegment)) {
+        munmap(map, sizeof(StatusSegment));
+        return false;
+    }
+    _segment = segment;
+    return true;
+}
+
+void StatusReader::close() {
+    if (_segment) {
+        munmap(const_cast<StatusSegment *>(_segment), sizeof(StatusSegment));
+        _segment = nullptr;
+    }
+}
+
+bool StatusReader::isOpen() const {
+    return _segment != nullptr;
+}
+
+bool StatusReader::read(ValveStatus &status) const {
+    if (!_segment || _segment->magic.load(std::memory_order_acquire) != STATUS_SEGMENT_MAGIC) {
+        return false;
+    }
+    return _segment->status.tryLoad(status, STATUS_READ_ATTEMPTS);
+}
+
+int StatusReader::publisherPid() const {
+    return _segment ? _segment->pid : 0;
+}
@@ -0,0 +1,95 @@
+#ifndef StatusSegment_h
+#define StatusSegment_h
+
+#include <atomic>
+#include <cstdint>
+#include "SeqLock.h"
+
+#define STATUS_SEGMENT_NAME "/motorized_valve.status" // POSIX shared memory name, under /dev/shm
+#define STATUS_SEGMENT_SIM_NAME "/motorized_valve_sim.status" // Used by the driver under --sim
+#define STATUS_SEGMENT_MAGIC 0x56535453 // "STSV", set once the segment is ready
+#define STATUS_SEGMENT_VERSION 1 // Bumped whenever ValveStatus changes
+#define STATUS_READ_ATTEMPTS 1000 // Overlapping stores a read rides out before giving up
+
+// Bits of ValveStatus::flags
+enum StatusFlag {
+    StatusMoving = 1, // Moving, calibrating or rehoming
+    StatusCalibrated = 2 // Range and position are known
+};
+
+// Bits of ValveStatus::faults
+enum StatusFault {
+    FaultPositionLost = 1, // An emergency stop cast doubt on the position
+    FaultMissedSteps = 2, // A limit switch was found too far from the counted position
+    FaultCommandFailed = 4 // The last command could not run, such as a move before calibration
+};
+
+// Valve state as published by PiStepper. Counters run from the start of
+// the publishing process and never reset.
+struct ValveStatus {
+    int32_t position; // Step count
+    int32_t target; // Step count the current move is heading for
+    int32_t fullRange; // Calibrated range in steps, 0 before calibration
+    float percentOpen; // Position as a percentage of the range, 0 before calibration
+    float velocity; // Steps per second, negative while closing
+    uint32_t phase; // MotionPlanner::Phase, 0 when idle
+    uint32_t flags; // StatusFlag bits
+    uint32_t faults; // StatusFault bits
+    uint32_t commands; // Commands the motion worker has finished
+    uint32_t emergencyStops;
+    uint32_t references; // Limit switch hits and rehomes the position was taken from
+    uint32_t alarms; // Missed-step alarms raised
+    uint64_t timestamp; // CLOCK_MONOTONIC time of the update in nanoseconds, comparable across processes
+};
+
+// Layout of the shared memory segment
+struct StatusSegment {
+    std::atomic<uint32_t> magic; // STATUS_SEGMENT_MAGIC while a publisher has it open
+    uint32_t version; // STATUS_SEGMENT_VERSION
+    uint32_t size; // sizeof(StatusSegment), guards against readers built with another layout
+    int32_t pid; // Publishing process
+    SeqLock<ValveStatus> status;
+};
+
+// Writes ValveStatus into a POSIX shared memory segment. Publishing is a
+// seqlock store into the mapping with no system calls, so it can run from
+// the step loop. One writer at a time; the caller serialises publish().
+class StatusPublisher {
+public:
+    StatusPublisher();
+    ~StatusPublisher();
+
+    bool open(const char *name); // Create the segment, or take over one whose publisher has exited
+    void close(); // Mark the segment stopped and remove it
+    bool isOpen() const;
+
+    void publish(const ValveStatus &status);
+
+private:
+    StatusSegment *_segment;
+    char _name[64];
+};
+
+// Maps a segment read-only. Once open, read() costs a few memory loads,
+// so any number of processes can poll it at high rates without touching
+// the publisher.
+class StatusReader {
+public:
+    StatusReader();
+    ~StatusReader();
+
+    bool open(const char *name); // Map the segment, false if no publisher has created it
+    void close();
+    bool isOpen() const;
+
+    // Latest status, false if the publisher has stopped or was caught in
+    // the middle of a store STATUS_READ_ATTEMPTS times. Reopen after the
+    // publisher restarts; the old mapping keeps reading as stopped.
+    bool read(ValveStatus &status) const;
+    int publisherPid() const; // Process that published the segment, 0 if not open
+
+private:
+    const StatusSegment *_segment;
+};
+
+#endif // StatusSegment_h
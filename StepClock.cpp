@@ -0,0 +1,64 @@
+#include "StepClock.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+
+uint64_t monotonicNow() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void sleepUntilDeadline(uint64_t deadline, uint64_t spinWindow) {
+    if (deadline > spinWindow) {
+        uint64_t wake = deadline - spinWindow;
+        if (monotonicNow() < wake) {
+            timespec ts;
+            ts.tv_sec = wake / 1000000000ULL;
+            ts.tv_nsec = wake % 1000000000ULL;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+            }
+        }
+    }
+    while (monotonicNow() < deadline) {
+    }
+}
+
+bool applyRealtime(const RealtimeOptions &options) {
+    if (!options.enabled) {
+        return true;
+    }
+
+    bool ok = true;
+    sched_param param;
+    param.sched_priority = options.priority;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+        std::cerr << "Failed to set SCHED_FIFO priority: " << std::strerror(err) << std::endl;
+        ok = false;
+    }
+
+    if (options.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(options.cpu, &cpus);
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err != 0) {
+            std::cerr << "Failed to pin step thread to CPU " << options.cpu << ": " << std::strerror(err) << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool lockProcessMemory() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "Failed to lock memory: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef StepClock_h
+#define StepClock_h
+
+#include <cstdint>
+
+#define DEFAULT_SPIN_WINDOW 50000 // ns before a deadline that are busy-waited instead of slept
+
+// Scheduling settings for the thread that generates step pulses
+struct RealtimeOptions {
+    bool enabled = false; // Apply the settings below to the step thread
+    int priority = 80; // SCHED_FIFO priority (1-99)
+    int cpu = -1; // CPU to pin the step thread to, -1 for no affinity
+    bool lockMemory = true; // mlockall() so the step loop never takes a page fault
+};
+
+uint64_t monotonicNow(); // CLOCK_MONOTONIC in nanoseconds
+
+// Sleep until an absolute CLOCK_MONOTONIC deadline. The thread sleeps with
+// clock_nanosleep(TIMER_ABSTIME) until spinWindow ns before the deadline and
+// spins for the rest, so wake-up latency does not push the edge late.
+void sleepUntilDeadline(uint64_t deadline, uint64_t spinWindow);
+
+bool applyRealtime(const RealtimeOptions &options); // Apply priority and affinity to the calling thread
+bool lockProcessMemory(); // Lock current and future pages into RAM
+
+#endif // StepClock_h
@@ -0,0 +1,65 @@
+#include "StepTimingStats.h"
+
+StepTimingStats::StepTimingStats() {
+    reset();
+}
+
+void StepTimingStats::recordEdge(int64_t lateness) {
+    bump(_steps, 1);
+    if (lateness < 0) {
+        bump(_early, 1);
+        lateness = 0;
+    }
+
+    uint64_t late = static_cast<uint64_t>(lateness);
+    bump(_totalLateness, late);
+    if (late > _worstLateness.load(std::memory_order_relaxed)) {
+        _worstLateness.store(late, std::memory_order_relaxed);
+    }
+
+    uint64_t microseconds = late / 1000;
+    int bucket = microseconds == 0 ? 0 : 64 - __builtin_clzll(microseconds);
+    if (bucket >= TIMING_BUCKETS) {
+        bucket = TIMING_BUCKETS - 1;
+    }
+    bump(_buckets[bucket], 1);
+}
+
+void StepTimingStats::recordOverrun() {
+    bump(_overruns, 1);
+}
+
+StepTimingSnapshot StepTimingStats::snapshot() const {
+    StepTimingSnapshot snapshot;
+    snapshot.steps = _steps.load(std::memory_order_relaxed);
+    snapshot.overruns = _overruns.load(std::memory_order_relaxed);
+    snapshot.early = _early.load(std::memory_order_relaxed);
+    snapshot.worstLateness = _worstLateness.load(std::memory_order_relaxed);
+    snapshot.totalLateness = _totalLateness.load(std::memory_order_relaxed);
+    for (int i = 0; i < TIMING_BUCKETS; i++) {
+        snapshot.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+void StepTimingStats::reset() {
+    _steps = 0;
+    _overruns = 0;
+    _early = 0;
+    _worstLateness = 0;
+    _totalLateness = 0;
+    for (std::atomic<uint64_t> &bucket : _buckets) {
+        bucket = 0;
+    }
+}
+
+uint64_t StepTimingStats::bucketLimit(int bucket) {
+    if (bucket >= TIMING_BUCKETS - 1) {
+        return 0;
+    }
+    return 1000ULL << bucket;
+}
+
+void StepTimingStats::bump(std::atomic<uint64_t> &counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
@@ -0,0 +1,47 @@
+#ifndef StepTimingStats_h
+#define StepTimingStats_h
+
+#include <atomic>
+#include <cstdint>
+
+#define TIMING_BUCKETS 16
+
+// Copy of the step timing counters taken at one moment
+struct StepTimingSnapshot {
+    uint64_t steps; // Step edges recorded
+    uint64_t overruns; // Times the loop fell a whole step behind and resynchronised
+    uint64_t early; // Edges written before their deadline
+    uint64_t worstLateness; // Largest lateness seen, in nanoseconds
+    uint64_t totalLateness; // Sum of lateness, in nanoseconds
+    uint64_t buckets[TIMING_BUCKETS]; // Lateness histogram, see StepTimingStats::bucketLimit()
+};
+
+// Histogram of how late step edges land against their scheduled deadline.
+// Bucket 0 counts edges less than 1 us late, bucket n edges from 2^(n-1)
+// to 2^n us late, and the last bucket everything beyond. Recording never
+// allocates or locks; it is meant to be called from the step loop only,
+// and the counters can be read from any thread.
+class StepTimingStats {
+public:
+    StepTimingStats();
+
+    void recordEdge(int64_t lateness); // Lateness of one edge in nanoseconds, negative if early
+    void recordOverrun(); // The loop fell a whole step behind
+    StepTimingSnapshot snapshot() const; // Copy the counters
+    void reset(); // Zero the counters, best done while no move is running
+
+    static uint64_t bucketLimit(int bucket); // Upper bound of a bucket in nanoseconds, 0 for the last
+
+private:
+    // Single writer, so plain load/store increments are enough
+    static void bump(std::atomic<uint64_t> &counter, uint64_t amount);
+
+    std::atomic<uint64_t> _steps;
+    std::atomic<uint64_t> _overruns;
+    std::atomic<uint64_t> _early;
+    std::atomic<uint64_t> _worstLateness;
+    std::atomic<uint64_t> _totalLateness;
+    std::atomic<uint64_t> _buckets[TIMING_BUCKETS];
+};
+
+#endif // StepTimingStats_h
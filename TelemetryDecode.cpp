@@ -0,0 +1,63 @@
+/**
+ * @file TelemetryDecode.cpp
+ * @brief Converts a PiStepper telemetry file to CSV
+ *
+ * Compilation:
+ * g++ -o TelemetryDecode TelemetryDecode.cpp
+ *
+ * Usage:
+ * ./TelemetryDecode telemetry.bin > telemetry.csv
+ */
+
+#include <cstdio>
+#include <iostream>
+#include "TelemetryRecorder.h"
+
+static const char *phaseName(uint8_t phase) {
+    static const char *names[] = {"idle", "accelerating", "cruising", "decelerating"};
+    return phase < 4 ? names[phase] : "unknown";
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <telemetry file>" << std::endl;
+        return 1;
+    }
+
+    FILE *file = std::fopen(argv[1], "rb");
+    if (!file) {
+        std::cerr << "Failed to open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    TelemetryHeader header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != TELEMETRY_MAGIC) {
+        std::cerr << argv[1] << " is not a telemetry file" << std::endl;
+        std::fclose(file);
+        return 1;
+    }
+    if (header.version != TELEMETRY_VERSION || header.recordSize != sizeof(TelemetryRecord)) {
+        std::cerr << "Unsupported telemetry version " << header.version << std::endl;
+        std::fclose(file);
+        return 1;
+    }
+
+    std::printf("timestamp_ns,step_index,direction,position,limit_top,limit_bottom,deadline_error_ns,phase\n");
+    TelemetryRecord record;
+    long count = 0;
+    while (std::fread(&record, sizeof(record), 1, file) == 1) {
+        std::printf("%llu,%u,%u,%d,%d,%d,%d,%s\n",
+                    static_cast<unsigned long long>(record.timestamp),
+                    record.stepIndex,
+                    record.direction,
+                    record.position,
+                    (record.limits & 1) ? 1 : 0, // GpioBackend::LimitTop
+                    (record.limits & 2) ? 1 : 0, // GpioBackend::LimitBottom
+                    record.deadlineError,
+                    phaseName(record.phase));
+        count++;
+    }
+    std::fclose(file);
+    std::cerr << count << " records" << std::endl;
+    return 0;
+}
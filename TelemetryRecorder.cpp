@@ -0,0 +1,110 @@
+#include "TelemetryRecorder.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+TelemetryRecorder::TelemetryRecorder() :
+    _ring(new SpscRing<TelemetryRecord, TELEMETRY_RING_SIZE>()),
+    _recording(false),
+    _stopping(false),
+    _dropped(0),
+    _fd(-1)
+{
+}
+
+TelemetryRecorder::~TelemetryRecorder() {
+    stop();
+}
+
+bool TelemetryRecorder::start(const char *path) {
+    stop();
+    _fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        std::cerr << "Failed to open telemetry file " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    TelemetryHeader header;
+    header.magic = TELEMETRY_MAGIC;
+    header.version = TELEMETRY_VERSION;
+    header.recordSize = sizeof(TelemetryRecord);
+    if (::write(_fd, &header, sizeof(header)) != sizeof(header)) {
+        std::cerr << "Failed to write telemetry file " << path << std::endl;
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+
+    _ring->clear(); // Nothing is pushed while stopped, this only drops leftovers
+    _dropped = 0;
+    _stopping = false;
+    _writer = std::thread(&TelemetryRecorder::run, this);
+    _recording = true;
+    return true;
+}
+
+void TelemetryRecorder::stop() {
+    _recording = false;
+    if (_writer.joinable()) {
+        _stopping = true;
+        _writer.join();
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+bool TelemetryRecorder::isRecording() const {
+    return _recording.load(std::memory_order_relaxed);
+}
+
+void TelemetryRecorder::record(const TelemetryRecord &record) {
+    if (!_recording.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (!_ring->push(record)) {
+        _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+uint64_t TelemetryRecorder::droppedRecords() const {
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+void TelemetryRecorder::run() {
+    // Polled rather than signalled, so the step loop never makes a syscall
+    TelemetryRecord batch[TELEMETRY_BATCH_SIZE];
+    while (!_stopping.load(std::memory_order_relaxed)) {
+        if (!drain(batch)) {
+            _recording = false;
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(TELEMETRY_FLUSH_INTERVAL));
+    }
+    drain(batch);
+}
+
+bool TelemetryRecorder::drain(TelemetryRecord *batch) {
+    size_t count;
+    while ((count = _ring->pop(batch, TELEMETRY_BATCH_SIZE)) > 0) {
+        const char *data = reinterpret_cast<const char *>(batch);
+        size_t remaining = count * sizeof(TelemetryRecord);
+        while (remaining > 0) {
+            ssize_t written = ::write(_fd, data, remaining);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                std::cerr << "Failed to write telemetry: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            data += written;
+            remaining -= written;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef TelemetryRecorder_h
+#define TelemetryRecorder_h
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include "SpscRing.h"
+
+#define TELEMETRY_RING_SIZE 8192 // Records buffered between the step loop and the writer
+#define TELEMETRY_BATCH_SIZE 512 // Records written per write() call
+#define TELEMETRY_FLUSH_INTERVAL 10 // ms between writer passes
+#define TELEMETRY_MAGIC 0x4c455456 // "VTEL"
+#define TELEMETRY_VERSION 1
+
+// One step as seen by the step loop. Files hold a TelemetryHeader followed
+// by these records back to back, in host byte order.
+struct TelemetryRecord {
+    uint64_t timestamp; // Backend clock time of the step edge in nanoseconds
+    uint32_t stepIndex; // Step number within the move, from 0
+    int32_t position; // Step count after the step
+    int32_t deadlineError; // Edge time minus its deadline in nanoseconds
+    uint8_t direction; // 1 opening, 0 closing
+    uint8_t limits; // GpioBackend::LimitFlag bits seen before the step
+    uint8_t phase; // MotionPlanner::Phase of the step
+    uint8_t reserved;
+};
+static_assert(sizeof(TelemetryRecord) == 24, "TelemetryRecord layout is part of the file format");
+
+struct TelemetryHeader {
+    uint32_t magic; // TELEMETRY_MAGIC
+    uint16_t version; // TELEMETRY_VERSION
+    uint16_t recordSize; // sizeof(TelemetryRecord)
+};
+static_assert(sizeof(TelemetryHeader) == 8, "TelemetryHeader layout is part of the file format");
+
+// Records steps to a binary file without slowing the step loop. record()
+// copies into a lock-free ring and returns; a writer thread drains the ring
+// in batches. Records that do not fit because the writer fell behind are
+// dropped and counted.
+class TelemetryRecorder {
+public:
+    TelemetryRecorder();
+    ~TelemetryRecorder();
+
+    bool start(const char *path); // Open the file and start recording, replacing any running recording
+    void stop(); // Write what is buffered and close the file
+    bool isRecording() const;
+
+    void record(const TelemetryRecord &record); // Step loop only, never blocks
+    uint64_t droppedRecords() const; // Records lost to a full ring since start()
+
+private:
+    void run(); // Writer thread body
+    bool drain(TelemetryRecord *batch); // Write everything buffered, false on a write error
+
+    std::unique_ptr<SpscRing<TelemetryRecord, TELEMETRY_RING_SIZE>> _ring;
+    std::atomic<bool> _recording;
+    std::atomic<bool> _stopping;
+    std::atomic<uint64_t> _dropped;
+    int _fd;
+    std::thread _writer;
+};
+
+#endif // TelemetryRecorder_h
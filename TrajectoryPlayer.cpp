@@ -0,0 +1,200 @@
+#include "TrajectoryPlayer.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+
+TrajectoryPlayer::TrajectoryPlayer(PiStepper &stepper) :
+    _stepper(stepper),
+    _deadband(TRAJECTORY_DEADBAND),
+    _playing(false),
+    _finished(false),
+    _stopping(false)
+{
+}
+
+TrajectoryPlayer::~TrajectoryPlayer() {
+    stop();
+}
+
+void TrajectoryPlayer::setDeadband(float percent) {
+    _deadband = std::max(percent, 0.0f);
+}
+
+float TrajectoryPlayer::getDeadband() const {
+    return _deadband;
+}
+
+bool TrajectoryPlayer::start() {
+    stop();
+    if (!_stepper.isCalibrated()) {
+        std::cerr << "Calibration is required before playing a trajectory." << std::endl;
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _points.clear();
+        _finished = false;
+        _stopping = false;
+    }
+    _playing = true;
+    _player = std::thread(&TrajectoryPlayer::run, this);
+    return true;
+}
+
+bool TrajectoryPlayer::push(const TrajectoryPoint &point) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _space.wait(lock, [this]() { return _stopping || _points.size() < TRAJECTORY_BUFFER; });
+    if (_stopping || _finished) {
+        return false;
+    }
+    if (!_points.empty() && point.time < _points.back().time) {
+        std::cerr << "Trajectory point times must not decrease." << std::endl;
+        return false;
+    }
+    _points.push_back(point);
+    return true;
+}
+
+void TrajectoryPlayer::finish() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _finished = true;
+}
+
+bool TrajectoryPlayer::playFile(const char *path) {
+    FILE *file = std::fopen(path, "r");
+    if (!file) {
+        std::cerr << "Failed to open trajectory " << path << std::endl;
+        return false;
+    }
+    if (!start()) {
+        std::fclose(file);
+        return false;
+    }
+    _reader = std::thread(&TrajectoryPlayer::feed, this, file);
+    return true;
+}
+
+void TrajectoryPlayer::stop() {
+    bool wasPlaying = _playing;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _space.notify_all();
+    if (_player.joinable()) {
+        _player.join();
+    }
+    if (_reader.joinable()) {
+        _reader.join();
+    }
+    if (wasPlaying) {
+        _stepper.stopMovement();
+    }
+}
+
+bool TrajectoryPlayer::isPlaying() const {
+    return _playing;
+}
+
+void TrajectoryPlayer::run() {
+    auto start = std::chrono::steady_clock::now();
+    auto tick = start;
+    int lastTarget = INT_MIN;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stopping) {
+                break;
+            }
+        }
+        if (!_stepper.isCalibrated()) {
+            std::cerr << "Trajectory stopped, the valve is no longer calibrated." << std::endl;
+            break;
+        }
+
+        double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        float percent;
+        bool done;
+        if (setpoint(time, percent, done)) {
+            int range = _stepper.getFullRangeCount();
+            int target = std::min(std::max(static_cast<int>(std::lround(percent / 100.0f * range)), 0), range);
+            int deadband = std::max(static_cast<int>(_deadband / 100.0f * range), 1);
+
+            // Small changes are held back, except that the last point is always reached
+            bool move = lastTarget == INT_MIN || std::abs(target - lastTarget) >= deadband || (done && target != lastTarget);
+            if (move && _stepper.moveToStepAsync(target, MotionQueue::ReplacePending, nullptr)) {
+                lastTarget = target;
+            }
+        }
+        if (done) {
+            break;
+        }
+
+        tick += std::chrono::milliseconds(TRAJECTORY_TICK);
+        std::this_thread::sleep_until(tick);
+    }
+
+    // Release a reader still waiting for room
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _space.notify_all();
+    _playing = false;
+}
+
+void TrajectoryPlayer::feed(FILE *file) {
+    char line[256];
+    int lineNumber = 0;
+    while (std::fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        char *text = line + std::strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\r' || *text == '\0') {
+            continue;
+        }
+        TrajectoryPoint point;
+        if (std::sscanf(text, "%lf %f", &point.time, &point.percent) != 2) {
+            std::cerr << "Trajectory line " << lineNumber << " is not \"<seconds> <percent>\"." << std::endl;
+            break;
+        }
+        point.percent = std::min(std::max(point.percent, 0.0f), 100.0f);
+        if (!push(point)) {
+            break;
+        }
+    }
+    std::fclose(file);
+    finish();
+}
+
+bool TrajectoryPlayer::setpoint(double time, float &percent, bool &done) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool consumed = false;
+    while (_points.size() >= 2 && _points[1].time <= time) {
+        _points.pop_front();
+        consumed = true;
+    }
+    if (consumed) {
+        _space.notify_all();
+    }
+
+    done = false;
+    if (_points.empty()) {
+        done = _finished;
+        return false;
+    }
+
+    // Before the first point and after the last one the setpoint holds
+    const TrajectoryPoint &from = _points[0];
+    if (_points.size() == 1 || time <= from.time) {
+        percent = from.percent;
+        done = _points.size() == 1 && _finished && time >= from.time;
+        return true;
+    }
+    const TrajectoryPoint &to = _points[1];
+    double fraction = to.time > from.time ? (time - from.time) / (to.time - from.time) : 1.0;
+    percent = from.percent + static_cast<float>(fraction) * (to.percent - from.percent);
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef TrajectoryPlayer_h
+#define TrajectoryPlayer_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "PiStepper.h"
+
+#define TRAJECTORY_BUFFER 256 // Points held ahead of the playback time
+#define TRAJECTORY_TICK 20 // ms between setpoint updates
+#define TRAJECTORY_DEADBAND 0.5f // Percent the setpoint has to change by before the valve is moved
+
+// A setpoint in a trajectory
+struct TrajectoryPoint {
+    double time; // Seconds from the start of playback, non-decreasing
+    float percent; // Percent open
+};
+
+// Plays a trajectory of (time, percent open) points on a PiStepper. Points
+// are streamed in with push(), which blocks while TRAJECTORY_BUFFER points
+// are waiting, so a recipe of any length is only ever partly in memory.
+// Every TRAJECTORY_TICK ms the setpoint is interpolated linearly between the
+// points around the playback time and, if it has moved by more than the
+// dead-band, the running move is steered to it.
+//
+// Trajectory files hold one point per line, "<seconds> <percent>", with
+// blank lines and lines starting with # ignored.
+class TrajectoryPlayer {
+public:
+    explicit TrajectoryPlayer(PiStepper &stepper);
+    ~TrajectoryPlayer();
+
+    void setDeadband(float percent); // Smallest setpoint change that moves the valve
+    float getDeadband() const;
+
+    bool start(); // Start the playback clock, points are pushed afterwards
+    bool push(const TrajectoryPoint &point); // Add the next point, blocks while the buffer is full, false once stopped
+    void finish(); // No more points; playback ends at the last one
+    bool playFile(const char *path); // start() and stream the points from a trajectory file
+    void stop(); // Abandon playback, the valve stops where it is
+    bool isPlaying() const;
+
+private:
+    void run(); // Playback thread body
+    void feed(FILE *file); // File reader thread body
+    bool setpoint(double time, float &percent, bool &done); // Interpolate and drop used points, false on underrun
+
+    PiStepper &_stepper;
+    std::atomic<float> _deadband;
+    std::atomic<bool> _playing;
+
+    std::mutex _mutex;
+    std::condition_variable _space; // push() waits here for room
+    std::deque<TrajectoryPoint> _points; // Guarded by _mutex
+    bool _finished; // Guarded by _mutex
+    bool _stopping; // Guarded by _mutex
+
+    std::thread _player;
+    std::thread _reader;
+};
+
+#endif // TrajectoryPlayer_h
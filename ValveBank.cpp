@@ -0,0 +1,569 @@
+#include "ValveBank.h"
+#include "PiStepper.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+ValveBank::ValveBank(std::unique_ptr<BankIo> io, int stepsPerRevolution, int microstepping) :
+    _io(std::move(io)),
+    _channelCount(std::min(_io->channelCount(), MAX_BANK_CHANNELS)),
+    _stepsPerRevolution(stepsPerRevolution),
+    _microstepping(microstepping),
+    _coordinatedTargets{},
+    _coordinatedPending(false),
+    _requestsPending(false),
+    _emergency(false),
+    _busy(false),
+    _shutdown(false)
+{
+    for (Channel &channel : _channels) {
+        channel.speed = DEFAULT_SPEED;
+        channel.acceleration = DEFAULT_ACCELERATION;
+        channel.jerk = DEFAULT_JERK;
+        channel.publishedPosition = 0;
+        channel.fullRange = 0;
+        channel.calibrated = false;
+        channel.positionLost = false;
+        channel.moving = false;
+        channel.grouped = false;
+    }
+    _io->writeEnables(0);
+    _timer = std::thread(&ValveBank::run, this);
+}
+
+ValveBank::~ValveBank() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _shutdown = true;
+        _requestsPending = true;
+    }
+    _wake.notify_one();
+    _timer.join();
+    _io->writeEnables(0);
+}
+
+void ValveBank::setSpeed(int channel, float speed) {
+    if (channel < 0 || channel >= _channelCount) {
+        return;
+    }
+    if (!(speed > 0) || speed > MAX_SPEED) {
+        std::cerr << "Speed must be above 0 and at most " << MAX_SPEED << " RPM." << std::endl;
+        return;
+    }
+    _channels[channel].speed = speed;
+}
+
+void ValveBank::setAcceleration(int channel, float acceleration) {
+    if (channel < 0 || channel >= _channelCount) {
+        return;
+    }
+    if (!(acceleration >= 0) || std::isinf(acceleration)) {
+        std::cerr << "Acceleration must be 0 or more RPM/s." << std::endl;
+        return;
+    }
+    _channels[channel].acceleration = acceleration;
+}
+
+void ValveBank::setJerk(int channel, float jerk) {
+    if (channel < 0 || channel >= _channelCount) {
+        return;
+    }
+    if (!(jerk >= 0) || std::isinf(jerk)) {
+        std::cerr << "Jerk must be 0 or more RPM/s^2." << std::endl;
+        return;
+    }
+    _channels[channel].jerk = jerk;
+}
+
+void ValveBank::setHoming(const BankHomingOptions &options) {
+    if (!(options.speed > 0) || options.maxTravel <= 0) {
+        std::cerr << "Homing needs a positive speed and travel." << std::endl;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _homing = options;
+    _homing.speed = std::min(options.speed, static_cast<float>(MAX_SPEED));
+}
+
+bool ValveBank::moveTo(int channel, int target) {
+    if (channel < 0 || channel >= _channelCount) {
+        return false;
+    }
+    Channel &c = _channels[channel];
+    if (!c.calibrated) {
+        std::cerr << "Calibration is required before moving valve " << channel << "." << std::endl;
+        return false;
+    }
+    if (c.grouped) {
+        std::cerr << "Valve " << channel << " is part of a coordinated move." << std::endl;
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        c.request.type = Request::Move;
+        c.request.target = std::min(std::max(target, 0), c.fullRange.load());
+        _requestsPending = true;
+        _busy = true;
+    }
+    _wake.notify_one();
+    return true;
+}
+
+bool ValveBank::moveToPercentOpen(int channel, float percent) {
+    if (channel < 0 || channel >= _channelCount) {
+        return false;
+    }
+    if (!std::isfinite(percent)) {
+        std::cerr << "Percent open must be a finite number." << std::endl;
+        return false;
+    }
+    percent = std::min(std::max(percent, 0.0f), 100.0f); // In range before the cast
+    return moveTo(channel, static_cast<int>((percent / 100.0f) * _channels[channel].fullRange));
+}
+
+bool ValveBank::moveCoordinated(const int *targets) {
+    for (int i = 0; i < _channelCount; i++) {
+        if (targets[i] >= 0 && !_channels[i].calibrated) {
+            std::cerr << "Calibration is required before moving valve " << i << "." << std::endl;
+            return false;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (int i = 0; i < _channelCount; i++) {
+            _coordinatedTargets[i] = targets[i] < 0 ? -1 : std::min(targets[i], _channels[i].fullRange.load());
+        }
+        _coordinatedPending = true;
+        _requestsPending = true;
+        _busy = true;
+    }
+    _wake.notify_one();
+    return true;
+}
+
+void ValveBank::stop(int channel) {
+    if (channel < 0 || channel >= _channelCount) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _channels[channel].request.type = Request::Stop;
+        _requestsPending = true;
+    }
+    _wake.notify_one();
+}
+
+void ValveBank::emergencyStop() {
+    _emergency = true; // Checked by the timing thread before every write
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _requestsPending = true;
+    }
+    _wake.notify_one();
+    std::cout << "Emergency Stop Activated!" << std::endl;
+}
+
+bool ValveBank::calibrate() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (int i = 0; i < _channelCount; i++) {
+            _channels[i].request.type = Request::Home;
+        }
+        _requestsPending = true;
+        _busy = true;
+    }
+    _wake.notify_one();
+    waitIdle();
+    bool calibrated = true;
+    for (int i = 0; i < _channelCount; i++) {
+        if (_channels[i].calibrated) {
+            std::cout << "Valve " << i << " calibration complete. Full range: " << _channels[i].fullRange << " steps." << std::endl;
+        } else {
+            std::cerr << "Valve " << i << " calibration failed." << std::endl;
+            calibrated = false;
+        }
+    }
+    return calibrated;
+}
+
+void ValveBank::waitIdle() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this]() { return !_busy; });
+}
+
+int ValveBank::getChannelCount() const {
+    return _channelCount;
+}
+
+int ValveBank::getCurrentStepCount(int channel) const {
+    return _channels[channel].publishedPosition.load(std::memory_order_relaxed);
+}
+
+int ValveBank::getFullRangeCount(int channel) const {
+    return _channels[channel].fullRange.load(std::memory_order_relaxed);
+}
+
+float ValveBank::getPercentOpen(int channel) const {
+    return (getCurrentStepCount(channel) / static_cast<float>(getFullRangeCount(channel))) * 100.0f;
+}
+
+bool ValveBank::isMoving(int channel) const {
+    return _channels[channel].moving.load(std::memory_order_relaxed);
+}
+
+bool ValveBank::isCalibrated(int channel) const {
+    return _channels[channel].calibrated.load(std::memory_order_relaxed);
+}
+
+bool ValveBank::isPositionTrusted(int channel) const {
+    return !_channels[channel].positionLost.load(std::memory_order_relaxed);
+}
+
+BankHomingOptions ValveBank::getHoming() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _homing;
+}
+
+void ValveBank::run() {
+    while (!_shutdown.load(std::memory_order_relaxed)) {
+        if (_requestsPending.load(std::memory_order_relaxed)) {
+            takeRequests();
+        }
+
+        // Find the earliest step due; followers are stepped with their leader
+        uint64_t next = UINT64_MAX;
+        for (int i = 0; i < _channelCount; i++) {
+            const Channel &c = _channels[i];
+            if (c.mode != Idle && c.mode != Following) {
+                next = std::min(next, c.deadline);
+            }
+        }
+
+        if (next == UINT64_MAX) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_requestsPending) {
+                _busy = false;
+                _idle.notify_all();
+                _wake.wait(lock, [this]() { return _requestsPending.load(); });
+            }
+            continue;
+        }
+
+        _io->sleepUntil(next);
+        if (_emergency.load(std::memory_order_relaxed)) {
+            continue; // takeRequests() halts everything on the next pass
+        }
+
+        // Gather every channel due within the window into one write
+        uint32_t top, bottom;
+        _io->readLimits(top, bottom);
+        uint32_t stepMask = 0;
+        uint32_t dueMask = 0;
+        for (int i = 0; i < _channelCount; i++) {
+            Channel &c = _channels[i];
+            if (c.mode == Idle || c.mode == Following || c.deadline > next + BANK_COALESCE_WINDOW) {
+                continue;
+            }
+
+            if ((c.mode == HomingBottom || c.mode == HomingTop) && next >= c.homingDeadline) {
+                std::cerr << "Valve " << i << " calibration timed out." << std::endl;
+                halt(i);
+                continue;
+            }
+            if (c.mode == HomingBottom && (bottom & (1u << i))) {
+                // Bottom reached: this is the zero point, now sweep up
+                c.position = 0;
+                c.publishedPosition = 0;
+                c.mode = HomingTop;
+                c.direction = 1;
+                float rate = rpmToStepRate(_activeHoming.speed);
+                c.planner.plan(_activeHoming.maxTravel, rate, 0, 0, rate);
+                writeDirections();
+                continue;
+            }
+            if (c.mode == HomingTop && (top & (1u << i))) {
+                c.fullRange = c.position;
+                c.calibrated = true;
+                c.positionLost = false;
+                std::cout << "Valve " << i << " reached the top limit switch." << std::endl;
+                halt(i);
+                continue;
+            }
+            if (blocked(i, top, bottom)) {
+                std::cout << "Valve " << i << (c.direction ? " top" : " bottom") << " limit switch triggered" << std::endl;
+                halt(i);
+                continue;
+            }
+
+            dueMask |= 1u << i;
+            stepMask |= 1u << i;
+            if (c.mode != Leading) {
+                continue;
+            }
+            for (int f = 0; f < _channelCount; f++) {
+                Channel &follower = _channels[f];
+                if (follower.mode != Following || follower.leader != i) {
+                    continue;
+                }
+                follower.error += follower.distance;
+                if (follower.error >= c.distance) {
+                    follower.error -= c.distance;
+                    if (blocked(f, top, bottom)) {
+                        halt(f);
+                    } else {
+                        stepMask |= 1u << f;
+                    }
+                }
+            }
+        }
+
+        if (stepMask) {
+            _io->writeSteps(stepMask);
+            _io->sleepUntil(_io->now() + BANK_PULSE_WIDTH);
+            _io->writeSteps(0);
+        }
+        for (int i = 0; i < _channelCount; i++) {
+            if (stepMask & (1u << i)) {
+                stepChannel(i);
+            }
+        }
+        for (int i = 0; i < _channelCount; i++) {
+            Channel &c = _channels[i];
+            if (!(dueMask & (1u << i))) {
+                continue;
+            }
+            uint64_t period = c.planner.nextInterval() * 1000;
+            c.deadline = std::max(c.deadline + period, next); // Never schedule into the past
+            if (c.planner.stepsRemaining() == 0) {
+                finishSegment(i);
+            }
+        }
+    }
+}
+
+void ValveBank::takeRequests() {
+    Request requests[MAX_BANK_CHANNELS];
+    int coordinated[MAX_BANK_CHANNELS];
+    bool coordinatedPending;
+    BankHomingOptions homing;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _requestsPending = false;
+        for (int i = 0; i < _channelCount; i++) {
+            requests[i] = _channels[i].request;
+            _channels[i].request.type = Request::None;
+        }
+        coordinatedPending = _coordinatedPending;
+        _coordinatedPending = false;
+        std::copy(_coordinatedTargets, _coordinatedTargets + _channelCount, coordinated);
+        homing = _homing;
+    }
+
+    if (_emergency.exchange(false)) {
+        // Like PiStepper, the positions stand but are no longer trusted
+        for (int i = 0; i < _channelCount; i++) {
+            halt(i);
+            _channels[i].positionLost = true;
+        }
+        _io->writeEnables(0);
+        return;
+    }
+
+    uint64_t now = _io->now();
+    for (int i = 0; i < _channelCount; i++) {
+        Channel &c = _channels[i];
+        switch (requests[i].type) {
+            case Request::None:
+                break;
+            case Request::Move:
+                if (c.mode == Idle) {
+                    c.target = requests[i].target;
+                    startSegment(i, now);
+                } else if (c.mode == Independent) {
+                    // Steer the running move from its current speed
+                    c.target = requests[i].target;
+                    int ahead = c.direction == 1 ? c.target - c.position : c.position - c.target;
+                    float speed = c.planner.currentSpeed();
+                    c.planner.replan(std::max(ahead, c.planner.brakingSteps(speed)), speed);
+                    if (c.planner.stepsRemaining() == 0) {
+                        finishSegment(i);
+                    }
+                }
+                break;
+            case Request::Stop:
+                if (c.mode == Independent || c.mode == Leading || c.mode == Following) {
+                    // A coordinated group ramps down behind its leader, the followers keep tracking it
+                    int lead = c.mode == Following ? c.leader : i;
+                    Channel &l = _channels[lead];
+                    float speed = l.planner.currentSpeed();
+                    int braking = l.planner.brakingSteps(speed);
+                    l.target = l.position + (l.direction == 1 ? braking : -braking);
+                    l.planner.replan(braking, speed);
+                    if (braking == 0) {
+                        halt(lead);
+                    }
+                } else if (c.mode != Idle) {
+                    halt(i); // A calibration sweep runs without ramps
+                }
+                break;
+            case Request::Home:
+                if (c.mode == Idle) {
+                    _activeHoming = homing;
+                    c.calibrated = false;
+                    c.mode = HomingBottom;
+                    c.direction = 0;
+                    c.deadline = now;
+                    c.homingDeadline = homing.timeout ? now + homing.timeout * 1000000ULL : UINT64_MAX;
+                    float rate = rpmToStepRate(homing.speed);
+                    c.planner.plan(homing.maxTravel, rate, 0, 0, rate);
+                    c.moving = true;
+                } else {
+                    std::cerr << "Valve " << i << " is moving and was not calibrated." << std::endl;
+                }
+                break;
+        }
+    }
+
+    if (coordinatedPending) {
+        startCoordinated(coordinated, now);
+    }
+    writeDirections();
+    writeEnables();
+}
+
+void ValveBank::startSegment(int channel, uint64_t now) {
+    Channel &c = _channels[channel];
+    if (c.position == c.target) {
+        c.mode = Idle;
+        c.moving = false;
+        return;
+    }
+    c.mode = Independent;
+    c.direction = c.target > c.position ? 1 : 0;
+    c.deadline = std::max(c.deadline, now);
+    planSegment(channel, std::abs(c.target - c.position));
+    c.moving = true;
+}
+
+void ValveBank::startCoordinated(const int *targets, uint64_t now) {
+    for (int i = 0; i < _channelCount; i++) {
+        if (targets[i] >= 0 && _channels[i].mode != Idle) {
+            std::cerr << "Coordinated move rejected: valve " << i << " is moving." << std::endl;
+            return;
+        }
+    }
+
+    // The channel with the longest move sets the pace for the group
+    int leader = -1;
+    int longest = 0;
+    for (int i = 0; i < _channelCount; i++) {
+        int distance = targets[i] >= 0 ? std::abs(targets[i] - _channels[i].position) : 0;
+        if (distance > longest) {
+            longest = distance;
+            leader = i;
+        }
+    }
+    if (leader < 0) {
+        return;
+    }
+
+    Channel &lead = _channels[leader];
+    lead.mode = Leading;
+    lead.target = targets[leader];
+    lead.distance = longest;
+    lead.direction = targets[leader] > lead.position ? 1 : 0;
+    lead.deadline = now;
+    lead.grouped = true;
+    lead.moving = true;
+    planSegment(leader, longest);
+
+    for (int i = 0; i < _channelCount; i++) {
+        Channel &c = _channels[i];
+        if (i == leader || targets[i] < 0 || targets[i] == c.position) {
+            continue;
+        }
+        c.mode = Following;
+        c.leader = leader;
+        c.target = targets[i];
+        c.distance = std::abs(targets[i] - c.position);
+        c.error = longest / 2; // Centre the follower steps within the leader's
+        c.direction = targets[i] > c.position ? 1 : 0;
+        c.grouped = true;
+        c.moving = true;
+    }
+}
+
+void ValveBank::finishSegment(int channel) {
+    Channel &c = _channels[channel];
+    if (c.mode == Independent && c.position != c.target) {
+        startSegment(channel, c.deadline); // Overshot a steered target, head back
+        writeDirections();
+        return;
+    }
+    if (c.mode == HomingBottom || c.mode == HomingTop) {
+        std::cerr << "Valve " << channel << " did not reach the " << (c.mode == HomingTop ? "top" : "bottom")
+                  << " limit switch within " << _activeHoming.maxTravel << " steps." << std::endl;
+    }
+    halt(channel);
+}
+
+void ValveBank::halt(int channel) {
+    Channel &c = _channels[channel];
+    if (c.mode == Leading) {
+        for (int i = 0; i < _channelCount; i++) {
+            if (_channels[i].mode == Following && _channels[i].leader == channel) {
+                halt(i);
+            }
+        }
+    }
+    c.mode = Idle;
+    c.leader = -1;
+    c.grouped = false;
+    c.moving = false;
+    writeEnables();
+}
+
+void ValveBank::stepChannel(int channel) {
+    Channel &c = _channels[channel];
+    c.position += c.direction == 1 ? 1 : -1;
+    c.publishedPosition.store(c.position, std::memory_order_relaxed);
+}
+
+bool ValveBank::blocked(int channel, uint32_t top, uint32_t bottom) const {
+    uint32_t bit = 1u << channel;
+    return _channels[channel].direction == 1 ? (top & bit) != 0 : (bottom & bit) != 0;
+}
+
+void ValveBank::planSegment(int channel, int steps) {
+    Channel &c = _channels[channel];
+    c.planner.plan(steps,
+                   rpmToStepRate(c.speed),
+                   rpmToStepRate(c.acceleration),
+                   rpmToStepRate(c.jerk),
+                   rpmToStepRate(START_SPEED));
+}
+
+float ValveBank::rpmToStepRate(float rpm) const {
+    return rpm * _stepsPerRevolution * _microstepping / 60.0f;
+}
+
+void ValveBank::writeDirections() {
+    uint32_t mask = 0;
+    for (int i = 0; i < _channelCount; i++) {
+        if (_channels[i].direction == 1) {
+            mask |= 1u << i;
+        }
+    }
+    _io->writeDirections(mask);
+}
+
+void ValveBank::writeEnables() {
+    uint32_t mask = 0;
+    for (int i = 0; i < _channelCount; i++) {
+        if (_channels[i].mode != Idle) {
+            mask |= 1u << i;
+        }
+    }
+    _io->writeEnables(mask);
+}
@@ -0,0 +1,135 @@
+#ifndef ValveBank_h
+#define ValveBank_h
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "BankIo.h"
+#include "MotionPlanner.h"
+
+#define BANK_COALESCE_WINDOW 20000 // ns, step edges due this close together share one write
+#define BANK_PULSE_WIDTH 5000 // ns the step lines are held high
+#define BANK_HOMING_SPEED 30 // RPM used by calibrate()
+#define BANK_HOMING_MAX_TRAVEL 20000 // Steps a sweep may take before calibration gives up on a channel
+#define BANK_HOMING_TIMEOUT 60000 // ms a whole calibration may take
+
+// How calibrate() sweeps each channel: down to the bottom switch and up to
+// the top one at a constant speed. A channel that does not reach a switch
+// within maxTravel steps of a sweep, or before the timeout, is stopped and
+// left uncalibrated.
+struct BankHomingOptions {
+    float speed = BANK_HOMING_SPEED; // RPM
+    int maxTravel = BANK_HOMING_MAX_TRAVEL; // Steps per sweep
+    uint32_t timeout = BANK_HOMING_TIMEOUT; // ms, 0 for no limit
+};
+
+// Drives several valves on one gpiochip from a single timing thread. Each
+// tick the thread sleeps to the earliest step deadline of any channel and
+// writes the step lines of every channel that is due in one bulk write.
+// Channels can move independently, each with its own profile, or as a
+// coordinated group: the channel with the longest move runs the profile
+// and the others are stepped from it with a Bresenham accumulator, so all
+// of them start and finish together.
+class ValveBank {
+public:
+    ValveBank(std::unique_ptr<BankIo> io, int stepsPerRevolution, int microstepping);
+    ~ValveBank();
+
+    // Setters, per channel and in the same units as PiStepper
+    void setSpeed(int channel, float speed); // Set the cruise speed in RPM
+    void setAcceleration(int channel, float acceleration); // Set the acceleration in RPM/s, 0 to run without ramps
+    void setJerk(int channel, float jerk); // Set the jerk limit in RPM/s^2, 0 for a trapezoidal profile
+    void setHoming(const BankHomingOptions &options); // Set the speed and limits used by calibrate()
+
+    // Motion
+    bool moveTo(int channel, int target); // Move one channel to a step count, steering a running move
+    bool moveToPercentOpen(int channel, float percent); // Move one channel to a percentage open
+    bool moveCoordinated(const int *targets); // Move every channel with targets[i] >= 0 so they finish together
+    void stop(int channel); // Decelerate one channel to a stop, a coordinated group ramps down together
+    void emergencyStop(); // Stop every channel immediately, disable the drivers and mark every position lost
+    bool calibrate(); // Sweep every channel between its limit switches, blocks until done, false if any channel failed
+    void waitIdle(); // Block until no channel is moving
+
+    // Getters
+    int getChannelCount() const; // Get the number of channels
+    int getCurrentStepCount(int channel) const; // Get a channel's step count
+    int getFullRangeCount(int channel) const; // Get a channel's calibrated range
+    float getPercentOpen(int channel) const; // Get a channel's position as a percentage of its range
+    bool isMoving(int channel) const; // Check if a channel is moving
+    bool isCalibrated(int channel) const; // Check if a channel has been calibrated
+    bool isPositionTrusted(int channel) const; // Check that no emergency stop has cast doubt on a channel's position since its calibration
+    BankHomingOptions getHoming() const; // Get the speed and limits used by calibrate()
+
+private:
+    enum Mode { Idle, Independent, Leading, Following, HomingBottom, HomingTop };
+
+    struct Request {
+        enum Type { None, Move, Stop, Home };
+        Type type = None;
+        int target = 0;
+    };
+
+    struct Channel {
+        // Settings, written by any thread and read when a segment is planned
+        std::atomic<float> speed;
+        std::atomic<float> acceleration;
+        std::atomic<float> jerk;
+
+        // Published by the timing thread
+        std::atomic<int> publishedPosition;
+        std::atomic<int> fullRange;
+        std::atomic<bool> calibrated;
+        std::atomic<bool> positionLost; // An emergency stop cast doubt on the position since the last calibration
+        std::atomic<bool> moving;
+        std::atomic<bool> grouped; // Part of a coordinated move
+
+        // Owned by the timing thread
+        Mode mode = Idle;
+        int position = 0;
+        int target = 0;
+        int direction = 0;
+        uint64_t deadline = 0; // Time of the next step edge
+        MotionPlanner planner;
+        int leader = -1; // Channel a follower is stepped from
+        int distance = 0; // Steps in a coordinated move, the leader's sets the Bresenham ratio
+        int error = 0; // Bresenham accumulator
+        uint64_t homingDeadline = 0; // Time a calibration sweep gives up
+        Request request; // Pending request, guarded by _mutex
+    };
+
+    void run(); // Timing thread body
+    void takeRequests(); // Apply pending requests, timing thread only
+    void startSegment(int channel, uint64_t now); // Plan a move from rest toward the channel target
+    void startCoordinated(const int *targets, uint64_t now); // Plan a coordinated group
+    void finishSegment(int channel); // Handle a channel whose plan has run out
+    void halt(int channel); // Stop a channel (and its followers) where it is
+    void stepChannel(int channel); // Account for a step edge that was just written
+    bool blocked(int channel, uint32_t top, uint32_t bottom) const; // Limit switch in the way
+    void planSegment(int channel, int steps); // Plan with the channel's settings
+    float rpmToStepRate(float rpm) const; // Convert RPM (or RPM/s, RPM/s^2) to steps
+    void writeDirections(); // Push every channel direction
+    void writeEnables(); // Enable exactly the channels that are moving
+
+    std::unique_ptr<BankIo> _io;
+    int _channelCount;
+    int _stepsPerRevolution;
+    int _microstepping;
+    Channel _channels[MAX_BANK_CHANNELS];
+    int _coordinatedTargets[MAX_BANK_CHANNELS]; // Pending coordinated request, guarded by _mutex
+    bool _coordinatedPending;
+    BankHomingOptions _homing; // Guarded by _mutex, read when a calibration starts
+    BankHomingOptions _activeHoming; // Copy the running calibration uses, timing thread only
+
+    mutable std::mutex _mutex;
+    std::condition_variable _wake; // Timing thread waits here while every channel is idle
+    std::condition_variable _idle; // waitIdle() waits here
+    std::atomic<bool> _requestsPending;
+    std::atomic<bool> _emergency;
+    bool _busy; // A channel is moving or a request is pending, guarded by _mutex
+    std::atomic<bool> _shutdown;
+    std::thread _timer;
+};
+
+#endif // ValveBank_h
@@ -0,0 +1,103 @@
+/**
+ * @file ValveClient.cpp
+ * @brief Command line client for the valve command server
+ *
+ * Compilation:
+ * g++ -o ValveClient ValveClient.cpp
+ *
+ * Usage:
+ * ./ValveClient "move 50" status     Send the requests in one write and print the responses
+ * ./ValveClient < script.txt         Same, one request per line
+ * ./ValveClient subscribe            Keep printing position updates
+ *
+ * Pass --socket <path> before the requests to use another socket.
+ */
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "CommandServer.h"
+
+int main(int argc, char *argv[]) {
+    const char *path = COMMAND_SOCKET_PATH;
+    int first = 1;
+    if (argc > 2 && std::strcmp(argv[1], "--socket") == 0) {
+        path = argv[2];
+        first = 3;
+    }
+
+    // Collect every request first so they go out pipelined in one write
+    std::string requests;
+    int expected = 0;
+    bool follow = false;
+    auto addRequest = [&](const std::string &line) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            return;
+        }
+        requests += line + "\n";
+        expected++;
+        follow = follow || line.compare(0, 9, "subscribe") == 0;
+    };
+    if (first < argc) {
+        for (int i = first; i < argc; i++) {
+            addRequest(argv[i]);
+        }
+    } else {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            addRequest(line);
+        }
+    }
+    if (expected == 0) {
+        std::cerr << "No requests given" << std::endl;
+        return 1;
+    }
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        std::cerr << "Failed to connect to " << path << std::endl;
+        return 1;
+    }
+
+    size_t offset = 0;
+    while (offset < requests.size()) {
+        ssize_t sent = send(fd, requests.data() + offset, requests.size() - offset, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            std::cerr << "Failed to send requests" << std::endl;
+            return 1;
+        }
+        offset += sent;
+    }
+
+    // One response per request; position updates are printed as they come
+    std::string input;
+    char buffer[4096];
+    int answered = 0;
+    bool failed = false;
+    while (answered < expected || follow) {
+        ssize_t received = read(fd, buffer, sizeof(buffer));
+        if (received <= 0) {
+            break;
+        }
+        input.append(buffer, received);
+        size_t end;
+        while ((end = input.find('\n')) != std::string::npos) {
+            std::string line = input.substr(0, end);
+            input.erase(0, end + 1);
+            std::cout << line << std::endl;
+            if (line.compare(0, 9, "position ") != 0) {
+                answered++;
+                failed = failed || line.compare(0, 6, "error ") == 0;
+            }
+        }
+    }
+    close(fd);
+    return failed || answered < expected ? 1 : 0;
+}
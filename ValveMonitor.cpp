@@ -0,0 +1,126 @@
+/**
+ * @file ValveMonitor.cpp
+ * @brief Prints the valve status from the shared memory segment
+ *
+ * Compilation:
+ * g++ -o ValveMonitor ValveMonitor.cpp StatusSegment.cpp -lrt
+ *
+ * Usage:
+ * ./ValveMonitor                 Print the status once
+ * ./ValveMonitor --watch [ms]    Print a line whenever the status changes, checking every ms (default 100)
+ *
+ * Pass --segment <name> first to read another segment, such as
+ * /motorized_valve_sim.status for a driver running under --sim. Reading never
+ * involves the valve process, so any number of monitors can run at once.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <time.h>
+#include "StatusSegment.h"
+
+static const char *phaseName(uint32_t phase) {
+    static const char *names[] = {"idle", "accelerating", "cruising", "decelerating"};
+    return phase < 4 ? names[phase] : "unknown";
+}
+
+static std::string faultNames(uint32_t faults) {
+    static const struct {
+        uint32_t bit;
+        const char *name;
+    } names[] = {
+        {FaultPositionLost, "position-lost"},
+        {FaultMissedSteps, "missed-steps"},
+        {FaultCommandFailed, "command-failed"},
+    };
+    std::string text;
+    for (const auto &fault : names) {
+        if (faults & fault.bit) {
+            text += (text.empty() ? "" : ",") + std::string(fault.name);
+        }
+    }
+    return text.empty() ? "none" : text;
+}
+
+static void printStatus(const ValveStatus &status) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t nowNs = static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+    double age = nowNs > status.timestamp ? (nowNs - status.timestamp) / 1e6 : 0;
+
+    std::cout << "position=" << status.position
+              << " target=" << status.target
+              << " range=" << status.fullRange
+              << " percent=" << status.percentOpen
+              << " velocity=" << status.velocity
+              << " phase=" << phaseName(status.phase)
+              << " moving=" << ((status.flags & StatusMoving) ? 1 : 0)
+              << " calibrated=" << ((status.flags & StatusCalibrated) ? 1 : 0)
+              << " faults=" << faultNames(status.faults)
+              << " commands=" << status.commands
+              << " estops=" << status.emergencyStops
+              << " references=" << status.references
+              << " alarms=" << status.alarms
+              << " age_ms=" << age << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const char *name = STATUS_SEGMENT_NAME;
+    bool watch = false;
+    int interval = 100;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--segment") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (std::strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                interval = std::max(std::atoi(argv[++i]), 1);
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--segment <name>] [--watch [ms]]" << std::endl;
+            return 1;
+        }
+    }
+
+    StatusReader reader;
+    ValveStatus status;
+    if (!watch) {
+        if (!reader.open(name) || !reader.read(status)) {
+            std::cerr << "No valve is publishing " << name << std::endl;
+            return 1;
+        }
+        printStatus(status);
+        return 0;
+    }
+
+    // Every update carries a new timestamp, so compare the rest
+    bool running = false;
+    ValveStatus last;
+    std::memset(&last, 0, sizeof(last));
+    while (true) {
+        if (!reader.isOpen()) {
+            reader.open(name); // The valve may start, or restart, at any time
+        }
+        if (reader.read(status)) {
+            ValveStatus compared = status;
+            compared.timestamp = last.timestamp;
+            if (!running || std::memcmp(&compared, &last, sizeof(compared)) != 0) {
+                printStatus(status);
+            }
+            last = status;
+            running = true;
+        } else {
+            if (running) {
+                std::cout << "stopped" << std::endl;
+            }
+            running = false;
+            reader.close();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+    }
+}
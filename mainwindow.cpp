@@ -1,21 +1,39 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
+// Log line for a finished move, such as "Quick move 1 limit-hit at step 0."
+static QString motionMessage(const QString &move, const MotionResult &result) {
+    return QString("%1 %2 at step %3.").arg(move).arg(motionOutcomeName(result.outcome)).arg(result.position);
+}
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , stepper(new PiStepper(27, 17, 22, 200, 1))
-    , timer(new QTimer(this))
-    , logModel(new QStringListModel(this))
+    , startupCalibration(false)
+    , reportedAlarms(0)
+    , logModel(new LogModel(LOG_MODEL_CAPACITY, this))
     , scene(new QGraphicsScene(this))
 {
     ui->setupUi(this);
+    restored = stepper->openJournal(STATE_JOURNAL_PATH);
+    stepper->openStatusSegment(STATUS_SEGMENT_NAME); // For the historian, the watchdog and ValveMonitor
     
     // === Overall UI elements setup ===
     ui->stackedWidget->setCurrentIndex(0);
 
     connect(ui->actionExit_Valve_Program, &QAction::triggered, this, &MainWindow::on_actionExit_Valve_Program_triggered);
-    connect(timer, &QTimer::timeout, this, &MainWindow::on_timer_updateProgressBar);
+    connect(ui->actionAcknowledge_Alarm, &QAction::triggered, this, &MainWindow::acknowledgeAlarm);
+
+    // The stepper reports from its motion worker, a few dozen times a second
+    // while moving, so hop to the GUI thread before touching the widgets
+    connect(this, &MainWindow::positionChanged, this, &MainWindow::updateProgressBar, Qt::QueuedConnection);
+    connect(this, &MainWindow::calibrationFinished, this, &MainWindow::onCalibrationFinished, Qt::QueuedConnection);
+    connect(this, &MainWindow::motionFinished, this, &MainWindow::onMotionFinished, Qt::QueuedConnection);
+    stepper->setMotionListener([this](const MotionState &state) {
+        int fullRange = stepper->getFullRangeCount();
+        emit positionChanged(fullRange > 0 ? state.position * 100 / fullRange : 0);
+    });
     connect(ui->estop_commandLinkButton, SIGNAL(clicked()), this, SLOT(on_emergencyStop_clicked()));
     
     // === Setup start page graphics ===
@@ -71,15 +89,17 @@ MainWindow::MainWindow(QWidget *parent)
     // Set up log list view
     logListView = ui->log_listView;
     logListView->setModel(logModel);
-    logMessages.clear();
+    logModel->setLogFile(LOG_FILE_PATH);
 
 
     setUIEnabled(false);    // Disable UI elements before calibration
-    timer->start(1000);     // Start timer to update UI elements
+    int fullRange = stepper->getFullRangeCount();
+    updateProgressBar(fullRange > 0 ? stepper->getCurrentStepCount() * 100 / fullRange : 0);
 }
 
 MainWindow::~MainWindow()
 {
+    delete stepper; // Shuts the motor down cleanly and marks the saved position as trusted
     delete ui;
 }
 
@@ -122,17 +142,81 @@ void MainWindow::on_actionExit_Valve_Program_triggered() {
 }
 
 void MainWindow::on_cal_clicked() {
-    stepper->calibrate();
-    addLogMessage("Calibration completed.");
+    startupCalibration = false;
+    startCalibration(false);
+}
+
+void MainWindow::startCalibration(bool rehome) {
+    // Runs on the motion worker; the emergency stop button stays live throughout
+    setUIEnabled(false);
+    ui->valve_pos_progressBar->setRange(0, 0); // Busy indicator until the range is known
+    auto done = [this]() { emit calibrationFinished(); };
+    bool queued = rehome ? stepper->rehomeAsync(done) : stepper->calibrateAsync(done);
+    if (!queued) {
+        ui->valve_pos_progressBar->setRange(0, 100);
+        setUIEnabled(true);
+        addLogMessage("Motion queue is full, calibration not started.", LogModel::Warning);
+        return;
+    }
+    addLogMessage(rehome ? "Re-referencing on the nearer limit switch." : "Calibration started.");
+}
+
+void MainWindow::onCalibrationFinished() {
+    ui->valve_pos_progressBar->setRange(0, 100);
+    int fullRange = stepper->getFullRangeCount();
+    updateProgressBar(fullRange > 0 ? stepper->getCurrentStepCount() * 100 / fullRange : 0);
+
+    if (!stepper->isCalibrated()) {
+        addLogMessage("Calibration failed or was stopped.", LogModel::Error);
+        if (!startupCalibration) {
+            ui->settings_toolButton->setEnabled(true); // Leave a way to calibrate again
+            ui->cal_commandLinkButton->setEnabled(true);
+        }
+        return;
+    }
+
+    addLogMessage(QString("Calibration completed. Full range: %1 steps.").arg(fullRange));
+    setUIEnabled(true);
+    if (startupCalibration) {
+        ui->stackedWidget->setCurrentIndex(3); // Switch to another page after calibration
+        startupCalibration = false;
+    }
+}
+
+void MainWindow::onMotionFinished(const QString &message) {
+    addLogMessage(message);
+
+    // Moves that run into a limit switch take the position from it. The
+    // alarm stays raised, also for the status segment readers, until the
+    // operator acknowledges it; only new alarms are logged.
+    ReferenceStats references = stepper->getReferenceStats();
+    if (references.missedSteps && references.alarms != reportedAlarms) {
+        reportedAlarms = references.alarms;
+        addLogMessage(QString("Missed steps: a limit switch was found up to %1 steps from the counted position. "
+                              "The position has been corrected; acknowledge the alarm from the Alarms menu "
+                              "once the valve has been checked.").arg(references.maxDrift), LogModel::Warning);
+        ui->actionAcknowledge_Alarm->setEnabled(true);
+    }
+}
+
+void MainWindow::acknowledgeAlarm() {
+    stepper->clearMissedStepAlarm();
+    reportedAlarms = 0; // The alarm count restarts with the statistics
+    ui->actionAcknowledge_Alarm->setEnabled(false);
+    addLogMessage("Missed-step alarm acknowledged.");
 }
 
 void MainWindow::on_fullOpen_clicked() {
-    stepper->moveToFullyOpen();
+    stepper->moveToPercentOpen(100.0f).then([this](const MotionResult &result) {
+        emit motionFinished(motionMessage("Full open", result));
+    });
     addLogMessage("Moving to fully open position.");
 }
 
 void MainWindow::on_fullClose_clicked() {
-    stepper->moveToFullyClosed();
+    stepper->moveToPercentOpen(0.0f).then([this](const MotionResult &result) {
+        emit motionFinished(motionMessage("Full close", result));
+    });
     addLogMessage("Moving to fully closed position.");
 }
 
@@ -142,18 +226,18 @@ void MainWindow::on_absMove_clicked() {
 
     if (!ok) {
         QMessageBox::warning(this, "Invalid input", "Please enter a valid number");
-        addLogMessage("Invalid input for percent occlusion.");
+        addLogMessage("Invalid input for percent occlusion.", LogModel::Warning);
         return;
     }
 
     if (value < 1.0 || value > 100.0) {
         QMessageBox::warning(this, "Out of range", "Please enter a number between 1 and 100");
-        addLogMessage("Percent occlusion out of range.");
+        addLogMessage("Percent occlusion out of range.", LogModel::Warning);
         return;
     }
 
-    stepper->moveToPercentOpen(value, []() {
-        std::cout << "Move to Percent Open operation completed." << std::endl;
+    stepper->moveToPercentOpen(value).then([this](const MotionResult &result) {
+        emit motionFinished(motionMessage("Move to percent open", result));
     });
     addLogMessage(QString("Moving valve to %1% open position.").arg(value));
 }
@@ -167,7 +251,7 @@ void MainWindow::on_relMove_clicked() {
 
     if (!ok) {
         QMessageBox::warning(this, "Invalid Input", "Please enter a valid number");
-        addLogMessage("Invalid input for relative move steps.");
+        addLogMessage("Invalid input for relative move steps.", LogModel::Warning);
         return;
     }
 
@@ -175,18 +259,17 @@ void MainWindow::on_relMove_clicked() {
 
     if (value < 1 || value > availableSteps) {
         QMessageBox::warning(this, "Out of range", QString("Please enter a number between 1 and %1").arg(availableSteps));
-        addLogMessage("Relative move steps out of range.");
+        addLogMessage("Relative move steps out of range.", LogModel::Warning);
         return;
     }
 
-    stepper->moveStepsAsync(value, dir, []() {
-        std::cout << "Move Steps operation completed." << std::endl;
+    stepper->moveStepsAsync(value, dir).then([this](const MotionResult &result) {
+        emit motionFinished(motionMessage("Relative move", result));
     });
     addLogMessage(QString("Moving valve %1 steps %2.").arg(value).arg(dir == 1 ? "open" : "closed"));
 }
 
-void MainWindow::on_timer_updateProgressBar() {
-    int percent = stepper->getPercentOpen();
+void MainWindow::updateProgressBar(int percent) {
     ui->valve_pos_progressBar->setValue(percent);
 }
 
@@ -196,13 +279,13 @@ void MainWindow::on_settingsOk_clicked() {
 
     if (!ok) {
         QMessageBox::warning(this,"Invalid Input", "Please enter a valid number.");
-        addLogMessage("Invalid speed input.");
+        addLogMessage("Invalid speed input.", LogModel::Warning);
         return;
     }
 
     if ((userSpeed < 1) || (userSpeed > MAX_SPEED)) {
-        QMessageBox::warning(this, "Out of Range", "Please enter a whole number between 1 and 20");
-        addLogMessage("Speed input out of range.");
+        QMessageBox::warning(this, "Out of Range", QString("Please enter a whole number between 1 and %1").arg(MAX_SPEED));
+        addLogMessage("Speed input out of range.", LogModel::Warning);
         return;
     } else {
         stepper->setSpeed(userSpeed);
@@ -218,12 +301,18 @@ void MainWindow::on_emergencyStop_clicked() {
     stepper->emergencyStop();
     setUIEnabled(false); // Disable UI elements
     QMessageBox::warning(this, "Emergency Stop Pressed", "Motor Operation Stopped");
-    addLogMessage("Emergency stop activated.");
+    addLogMessage("Emergency stop activated.", LogModel::Error);
+
+    // The range is still known, so finding one limit switch again is enough
+    if (stepper->getFullRangeCount() > 0 &&
+        QMessageBox::question(this, "Re-reference Position",
+                              "Re-reference the position on the nearer limit switch?") == QMessageBox::Yes) {
+        startCalibration(true);
+    }
 }
 
-void MainWindow::addLogMessage(const QString &message) {
-    logMessages.append(message);
-    logModel->setStringList(logMessages);
+void MainWindow::addLogMessage(const QString &message, LogModel::Severity severity) {
+    logModel->append(severity, message);
     logListView->scrollToBottom();
 }
 
@@ -240,10 +329,18 @@ void MainWindow::setUIEnabled(bool enabled) {
 }
 
 void MainWindow::on_startPageOk_clicked() {
-    setUIEnabled(false); // Disable UI elements
-    stepper->calibrate();
-    setUIEnabled(true); // Enable UI elements after calibration
-    ui->stackedWidget->setCurrentIndex(3); // Switch to another page after calibration
+    PiStepper::Restored state = restored;
+    restored = PiStepper::RestoredNothing; // Coming back to the start page recalibrates
+    if (state == PiStepper::RestoredPosition) {
+        addLogMessage("Restored calibration and position from the last session.");
+        setUIEnabled(true);
+        ui->stackedWidget->setCurrentIndex(3);
+        return;
+    }
+
+    // Range is known after a crash, so only the position needs finding
+    startupCalibration = true;
+    startCalibration(state == PiStepper::RestoredRange);
 }
 
 void MainWindow::on_quickMove1_clicked() {
@@ -255,12 +352,12 @@ void MainWindow::on_quickMove1_clicked() {
 
     if (!ok) {
         QMessageBox::warning(this, "Invalid Input", "Please enter a valid number");
-        addLogMessage("Invalid input for quick move 1.");
+        addLogMessage("Invalid input for quick move 1.", LogModel::Warning);
         return;
     }
 
-    stepper->moveStepsAsync(value, dir, []() {
-        std::cout << "Quick Move 1 operation completed." << std::endl;
+    stepper->moveStepsAsync(value, dir).then([this](const MotionResult &result) {
+        emit motionFinished(motionMessage("Quick move 1", result));
     });
     addLogMessage(QString("Quick move 1: %1 steps %2.").arg(value).arg(dir == 1 ? "open" : "closed"));
 }
@@ -274,12 +371,12 @@ void MainWindow::on_quickMove2_clicked() {
 
     if (!ok) {
         QMessageBox::warning(this, "Invalid Input", "Please enter a valid number");
-        addLogMessage("Invalid input for quick move 2.");
+        addLogMessage("Invalid input for quick move 2.", LogModel::Warning);
         return;
     }
 
-    stepper->moveStepsAsync(value, dir, []() {
-        std::cout << "Quick Move 2 operation completed." << std::endl;
+    stepper->moveStepsAsync(value, dir).then([this](const MotionResult &result) {
+        emit motionFinished(motionMessage("Quick move 2", result));
     });
     addLogMessage(QString("Quick move 2: %1 steps %2.").arg(value).arg(dir == 1 ? "open" : "closed"));
 }
@@ -293,12 +390,12 @@ void MainWindow::on_quickMove3_clicked() {
 
     if (!ok) {
         QMessageBox::warning(this, "Invalid Input", "Please enter a valid number");
-        addLogMessage("Invalid input for quick move 3.");
+        addLogMessage("Invalid input for quick move 3.", LogModel::Warning);
         return;
     }
 
-    stepper->moveStepsAsync(value, dir, []() {
-        std::cout << "Quick Move 3 operation completed." << std::endl;
+    stepper->moveStepsAsync(value, dir).then([this](const MotionResult &result) {
+        emit motionFinished(motionMessage("Quick move 3", result));
     });
     addLogMessage(QString("Quick move 3: %1 steps %2.").arg(value).arg(dir == 1 ? "open" : "closed"));
 }
@@ -312,12 +409,12 @@ void MainWindow::on_quickMove4_clicked() {
 
     if (!ok) {
         QMessageBox::warning(this, "Invalid Input", "Please enter a valid number");
-        addLogMessage("Invalid input for quick move 4.");
+        addLogMessage("Invalid input for quick move 4.", LogModel::Warning);
         return;
     }
 
-    stepper->moveStepsAsync(value, dir, []() {
-        std::cout << "Quick Move 4 operation completed." << std::endl;
+    stepper->moveStepsAsync(value, dir).then([this](const MotionResult &result) {
+        emit motionFinished(motionMessage("Quick move 4", result));
     });
     addLogMessage(QString("Quick move 4: %1 steps %2.").arg(value).arg(dir == 1 ? "open" : "closed"));
 }
@@ -3,10 +3,9 @@
 
 #include <QMainWindow>
 #include <QListView>
-#include <QStringListModel>
 #include <PiStepper.h>
+#include "LogModel.h"
 #include <QMessageBox>
-#include <QTimer>
 #include <QGraphicsScene>
 #include <QLabel>  // Add this line
 
@@ -22,10 +21,18 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+signals:
+    // Emitted from the motion worker, delivered through queued connections
+    void positionChanged(int percent);
+    void calibrationFinished();
+    void motionFinished(const QString &message);
+
 private slots:
 
     // Overall UI slots
-    void on_timer_updateProgressBar();
+    void updateProgressBar(int percent);
+    void onCalibrationFinished();
+    void onMotionFinished(const QString &message);
     void on_emergencyStop_clicked();
     void on_startPageOk_clicked();
 
@@ -36,6 +43,7 @@ private slots:
 
     // Menu bar slots
     void on_actionExit_Valve_Program_triggered();
+    void acknowledgeAlarm();
 
     // Settings page slots
     void on_cal_clicked();
@@ -57,19 +65,21 @@ private slots:
 private:
     Ui::MainWindow *ui;
     PiStepper *stepper; // Stepper motor object
-    QTimer *timer;      // Timer to update UI elements
+    PiStepper::Restored restored; // State recovered from the last session
+    bool startupCalibration; // The running calibration was started from the start page
+    uint32_t reportedAlarms; // Missed-step alarms already logged since the last acknowledgement
 
     // Log messages objects
     QListView *logListView;
-    QStringListModel *logModel;
-    QStringList logMessages;
+    LogModel *logModel;
 
     QGraphicsScene *scene;
     void setupStartPageGraphics();
 
     void setUIEnabled(bool enabled);
+    void startCalibration(bool rehome);
 
-    void addLogMessage(const QString &message);
+    void addLogMessage(const QString &message, LogModel::Severity severity = LogModel::Info);
 };
 
 #endif // MAINWINDOW_H
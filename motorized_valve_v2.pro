@@ -9,18 +9,43 @@ CONFIG += c++17
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    LibgpiodBackend.cpp \
+    LogModel.cpp \
+    MotionHandle.cpp \
+    MotionPlanner.cpp \
+    MotionQueue.cpp \
     PiStepper.cpp \
+    RotatingLogFile.cpp \
+    StateJournal.cpp \
+    StatusSegment.cpp \
+    StepClock.cpp \
+    StepTimingStats.cpp \
+    TelemetryRecorder.cpp \
     main.cpp \
     mainwindow.cpp
 
 HEADERS += \
+    GpioBackend.h \
+    LibgpiodBackend.h \
+    LogModel.h \
+    MotionHandle.h \
+    MotionPlanner.h \
+    MotionQueue.h \
     PiStepper.h \
+    RotatingLogFile.h \
+    SeqLock.h \
+    SpscRing.h \
+    StateJournal.h \
+    StatusSegment.h \
+    StepClock.h \
+    StepTimingStats.h \
+    TelemetryRecorder.h \
     mainwindow.h
 
 FORMS += \
     mainwindow.ui
 
-LIBS += -lgpiod -pthread
+LIBS += -lgpiod -pthread -lrt
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin